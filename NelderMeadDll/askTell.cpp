@@ -0,0 +1,212 @@
+#include "pch.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include "askTell.h"
+#include "vectorOps.h"
+
+static askTellNelderMead& checkSolver(askTellNelderMead* solver) {
+	if (solver == nullptr) throw solverError(incorrectArgument, "Incorrect solver");
+	return *solver;
+}
+
+askTellNelderMead* createAskTellSolver(pointsCallback callback, int varsCount, double* startingPointPtr) {
+	return reportErrors<askTellNelderMead*>(nullptr, [&] {
+		if (varsCount <= 0) throw solverError(incorrectArgument, "Incorrect number of variables");
+		return new askTellNelderMead(callback, varsCount, startingPointPtr);
+	});
+}
+
+// Copies the requested points into pointsPtr, varsCount values per point.
+// The buffer must hold (varsCount + 1) * varsCount values. Returns the number
+// of points, 0 when the optimization has finished or -1 on error.
+int askPoints(askTellNelderMead* solver, double* pointsPtr) {
+	return reportErrors(-1, [&] {
+		const vector<vector<double>>& points = checkSolver(solver).ask();
+		if (!points.empty() && pointsPtr == nullptr) throw solverError(incorrectArgument, "Incorrect points buffer");
+		for (int i = 0; i < points.size(); i++)
+			std::copy(points[i].begin(), points[i].end(), pointsPtr + i * points[i].size());
+		return (int)points.size();
+	});
+}
+
+void tellValues(askTellNelderMead* solver, double* valuesPtr) {
+	reportErrors(false, [&] {
+		size_t count = checkSolver(solver).ask().size();
+		if (valuesPtr == nullptr) throw solverError(incorrectArgument, "Incorrect values");
+		solver->tell(vector<double>(valuesPtr, valuesPtr + count));
+		return true;
+	});
+}
+
+double* getSolverResult(askTellNelderMead* solver) {
+	return reportErrors<double*>(nullptr, [&] {
+		vector<double> resultPoint = checkSolver(solver).result();
+		double* res = new double[resultPoint.size()];
+		std::copy(resultPoint.begin(), resultPoint.end(), res);
+		return res;
+	});
+}
+
+void destroyAskTellSolver(askTellNelderMead* solver) {
+	reportErrors(false, [&] {
+		delete &checkSolver(solver);
+		return true;
+	});
+}
+
+askTellNelderMead::askTellNelderMead(pointsCallback callback, int varsCount, double* startingPointPtr):
+	nelderMead(callback, nullptr, false),
+	varsCount(varsCount),
+	task(solve(vector<double>(startingPointPtr, startingPointPtr + varsCount)))
+{
+	checkBounds(varsCount);
+	prepareConstraints(varsCount);
+	task.resume();
+}
+
+askTellNelderMead::askTellNelderMead(pointsCallback callback, int varsCount, double* startingPointPtr, nelderMeadParams params):
+	nelderMead(callback, nullptr, params, false),
+	varsCount(varsCount),
+	task(solve(vector<double>(startingPointPtr, startingPointPtr + varsCount)))
+{
+	checkBounds(varsCount);
+	prepareConstraints(varsCount);
+	task.resume();
+}
+
+const vector<vector<double>>& askTellNelderMead::ask()
+{
+	return pending;
+}
+
+void askTellNelderMead::tell(const vector<double>& told)
+{
+	if (pending.empty()) throw solverError(incorrectArgument, "No points were requested");
+	if (told.size() != pending.size()) throw solverError(incorrectArgument, "Incorrect number of values");
+	values = told;
+	// a failed evaluation is just a very bad point
+	for (double& value : values)
+		if (!isfinite(value)) value = numeric_limits<double>::infinity();
+	pending.clear();
+	task.resume();
+}
+
+bool askTellNelderMead::finished()
+{
+	return task.done();
+}
+
+void askTellNelderMead::reevaluate()
+{
+	reevaluationRequested = true;
+}
+
+void askTellNelderMead::setApproximate(bool value)
+{
+	approximateValues = value;
+}
+
+bool askTellNelderMead::approximate()
+{
+	return approximateValues;
+}
+
+vector<double> askTellNelderMead::result()
+{
+	if (simplex.empty()) throw solverError(incorrectArgument, "Optimization has not started");
+	return simplex.front().point;
+}
+
+// Queues the feasible points for ask(); returns true when there are none.
+bool askTellNelderMead::request(const vector<vector<double>>& points)
+{
+	feasible.clear();
+	for (const vector<double>& point : points) {
+		feasible.push_back(isFeasible(point));
+		if (feasible.back()) pending.push_back(point);
+	}
+	return pending.empty();
+}
+
+// The told values in the order of the request, +inf for infeasible points.
+vector<double> askTellNelderMead::collectValues()
+{
+	vector<double> result;
+	size_t told = 0;
+	for (bool isTold : feasible)
+		result.push_back(isTold ? values[told++] : numeric_limits<double>::infinity());
+	values.clear();
+	return result;
+}
+
+// The classic single-vertex algorithm of nelderMead::run, with every
+// evaluation turned into a suspension point.
+optimizationTask askTellNelderMead::solve(vector<double> startingPoint)
+{
+	nelderMeadStep step(params);
+	projectToBounds(startingPoint);
+	vector<vector<double>> points(1, startingPoint);
+	for (int i = 0; i < varsCount; i++)
+		points.push_back(startingVertex(startingPoint, i));
+	vector<double> startValues = co_await evaluate(points);
+	for (int i = 0; i < points.size(); i++)
+		simplex.push_back(element(move(points[i]), startValues[i]));
+
+	for (int k = 0; k < params.maxSteps; k++) {
+		if (reevaluationRequested) {
+			reevaluationRequested = false;
+			vector<vector<double>> vertices;
+			for (const element& vertex : simplex) vertices.push_back(vertex.point);
+			vector<double> refreshed = co_await evaluate(vertices);
+			for (int i = 0; i < simplex.size(); i++) simplex[i].functionValue = refreshed[i];
+		}
+		std::sort(simplex.begin(), simplex.end(),
+			[](const element& a, const element& b) {
+				return a.functionValue < b.functionValue;
+			}
+		);
+		if (callback != nullptr) sendPoints();
+		if (endCheck(params.eps, simplex)) {
+			if (!approximateValues) break;
+			approximateValues = false;
+			reevaluationRequested = true;
+			continue;
+		}
+		logSimplex(k);
+
+		int keptCount = simplex.size() - 1;
+		element& worst = simplex.back();
+		vector<double> massCenter = calculateMassCenter(keptCount);
+		element reflection = co_await evaluate(trialPoint(massCenter, worst.point, step.reflection));
+		logPoint(reflectionLabel, reflection.point);
+		nelderMeadStep::outcome outcome = afterReflection(reflection, keptCount);
+		if (outcome == nelderMeadStep::acceptReflection) {
+			worst = reflection;
+		}
+		else if (outcome == nelderMeadStep::tryExpansion) {
+			element expansion = co_await evaluate(trialPoint(massCenter, reflection.point, step.expansion));
+			logPoint(expansionLabel, expansion.point);
+			if (nelderMeadStep::isExpansionAccepted(expansion.functionValue, reflection.functionValue)) worst = expansion;
+			else worst = reflection;
+		}
+		else {
+			vector<double>& towards = nelderMeadStep::contractsTowardsVertex(worst.functionValue, reflection.functionValue) ? worst.point : reflection.point;
+			element contraction = co_await evaluate(trialPoint(massCenter, towards, step.contraction));
+			logPoint(contractionLabel, contraction.point);
+			if (nelderMeadStep::isContractionAccepted(contraction.functionValue, worst.functionValue, reflection.functionValue)) {
+				worst = contraction;
+			}
+			else {
+				vector<vector<double>> contracted;
+				for (int i = 1; i < simplex.size(); i++)
+					contracted.push_back(trialPoint(simplex[i].point, simplex.front().point, nelderMeadStep::shrink));
+				vector<double> contractedValues = co_await evaluate(contracted);
+				for (int i = 1; i < simplex.size(); i++)
+					simplex[i] = element(move(contracted[i - 1]), contractedValues[i - 1]);
+			}
+		}
+	}
+	output->write(bestLabel + printVector(simplex.front().point, -1));
+	output->closeFile();
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <coroutine>
+#include <exception>
+#include <vector>
+#include "neldermead.h"
+
+using namespace std;
+
+// Coroutine handle for one optimization run. It suspends whenever the
+// algorithm needs function values and is resumed once they are supplied.
+class optimizationTask {
+public:
+	struct promise_type {
+		exception_ptr error;
+		optimizationTask get_return_object() {
+			return optimizationTask(coroutine_handle<promise_type>::from_promise(*this));
+		}
+		suspend_always initial_suspend() noexcept { return {}; }
+		suspend_always final_suspend() noexcept { return {}; }
+		void return_void() {}
+		void unhandled_exception() { error = current_exception(); }
+	};
+
+	optimizationTask() : handle(nullptr) {}
+	optimizationTask(coroutine_handle<promise_type> handle) : handle(handle) {}
+	optimizationTask(optimizationTask&& other) noexcept : handle(other.handle) { other.handle = nullptr; }
+	optimizationTask& operator=(optimizationTask&& other) noexcept {
+		if (this != &other) {
+			if (handle) handle.destroy();
+			handle = other.handle;
+			other.handle = nullptr;
+		}
+		return *this;
+	}
+	optimizationTask(const optimizationTask&) = delete;
+	optimizationTask& operator=(const optimizationTask&) = delete;
+	~optimizationTask() {
+		if (handle) handle.destroy();
+	}
+	bool done() {
+		return !handle || handle.done();
+	}
+	void resume() {
+		handle.resume();
+		if (handle.promise().error) rethrow_exception(handle.promise().error);
+	}
+
+private:
+	coroutine_handle<promise_type> handle;
+};
+
+// Nelder-Mead driven from the outside: ask() hands out the points that need
+// a function value, tell() feeds the values back and advances the algorithm
+// to its next request. The caller decides how and where points are evaluated.
+class askTellNelderMead : public nelderMead {
+public:
+	askTellNelderMead(pointsCallback callback, int varsCount, double* startingPointPtr);
+	askTellNelderMead(pointsCallback callback, int varsCount, double* startingPointPtr, nelderMeadParams params);
+	const vector<vector<double>>& ask();
+	void tell(const vector<double>& values);
+	bool finished();
+	vector<double> result();
+	// Makes the next step start by evaluating the whole simplex again, e.g.
+	// after the caller has switched to a more accurate evaluation.
+	void reevaluate();
+	// Marks the told values as approximate. A run that meets its end
+	// criteria on approximate values is not finished: it clears the mark,
+	// evaluates its simplex again and goes on until it converges on the
+	// accurate values.
+	void setApproximate(bool value);
+	bool approximate();
+
+private:
+	// Only feasible points are handed out; the coroutine is not suspended
+	// when there are none.
+	struct evaluationRequest {
+		askTellNelderMead& solver;
+		vector<vector<double>> points;
+		bool await_ready() { return solver.request(points); }
+		void await_suspend(coroutine_handle<>) {}
+		vector<double> await_resume() { return solver.collectValues(); }
+	};
+	struct pointRequest {
+		askTellNelderMead& solver;
+		vector<double> point;
+		bool await_ready() { return solver.request({ point }); }
+		void await_suspend(coroutine_handle<>) {}
+		element await_resume() { return element(move(point), solver.collectValues().front()); }
+	};
+
+	int varsCount;
+	bool reevaluationRequested = false;
+	bool approximateValues = false;
+	vector<vector<double>> pending;
+	vector<bool> feasible;
+	vector<double> values;
+	optimizationTask task;
+
+	evaluationRequest evaluate(vector<vector<double>> points) { return { *this, move(points) }; }
+	pointRequest evaluate(vector<double> point) { return { *this, move(point) }; }
+	bool request(const vector<vector<double>>& points);
+	vector<double> collectValues();
+	optimizationTask solve(vector<double> startingPoint);
+};
+
+extern "C" MYDLL_API askTellNelderMead* createAskTellSolver(pointsCallback callback, int varsCount, double* startingPointPtr);
+extern "C" MYDLL_API int askPoints(askTellNelderMead* solver, double* pointsPtr);
+extern "C" MYDLL_API void tellValues(askTellNelderMead* solver, double* valuesPtr);
+extern "C" MYDLL_API double* getSolverResult(askTellNelderMead* solver);
+extern "C" MYDLL_API void destroyAskTellSolver(askTellNelderMead* solver);
@@ -0,0 +1,109 @@
+#include "pch.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include "batchSolver.h"
+
+batchNelderMead::batchNelderMead(int problemsCount, int varsCount, double* startingPointsPtr, char* function, nelderMeadParams params,
+	int parametersCount, const double* parametersPtr):
+	varsCount(varsCount),
+	parametersCount(parametersCount),
+	parameters(parametersPtr, parametersPtr + problemsCount * parametersCount),
+	// the starting simplex is the largest request a problem makes
+	capacity(problemsCount * (varsCount + 1)),
+	lanes(capacity * (varsCount + parametersCount)),
+	values(capacity)
+{
+	parser.set_indexed_variables(lanes.data(), varsCount + parametersCount, capacity);
+	parser.set_indexed_parameters(parametersCount);
+	if (!parser.compile(function)) throw solverError(incorrectExpression, "Incorrect expression");
+	randomSeed = params.randomSeed;
+	if (params.singlePrecision) {
+		floatLanes.resize(lanes.size());
+		floatValues.resize(capacity);
+		floatParser.set_indexed_variables(floatLanes.data(), varsCount + parametersCount, capacity);
+		floatParser.set_indexed_parameters(parametersCount);
+		if (!floatParser.compile(function)) throw solverError(incorrectExpression, "Incorrect expression");
+	}
+
+	// every problem would otherwise write its own log.txt
+	params.outputType = "none";
+	params.method = "nelderMead";
+	params.parallelVertices = 1;
+	params.speculative = false;
+	for (int i = 0; i < problemsCount; i++) {
+		problems.push_back(make_unique<askTellNelderMead>(nullptr, varsCount, startingPointsPtr + i * varsCount, params));
+		problems.back()->setApproximate(params.singlePrecision);
+	}
+}
+
+// Evaluates the pending points of all unfinished problems in one pass.
+// Returns false when every problem has finished.
+bool batchNelderMead::evaluateRound()
+{
+	size_t count = 0, floatCount = 0;
+	for (size_t p = 0; p < problems.size(); p++) {
+		if (problems[p]->finished()) continue;
+		vector<double>& target = problems[p]->approximate() ? floatLanes : lanes;
+		size_t& used = problems[p]->approximate() ? floatCount : count;
+		for (const vector<double>& point : problems[p]->ask()) {
+			for (int j = 0; j < varsCount; j++)
+				target[j * capacity + used] = point[j];
+			for (int j = 0; j < parametersCount; j++)
+				target[(varsCount + j) * capacity + used] = parameters[p * parametersCount + j];
+			used++;
+		}
+	}
+	if (count + floatCount == 0) return false;
+
+	// lanes draw their random numbers in order, from a stream per round
+	if (randomSeed != 0) te_parser::set_random_stream(randomSeed, 2 * rounds);
+	if (count > 0) parser.evaluate_batch(count, values.data());
+	if (randomSeed != 0) te_parser::set_random_stream(randomSeed, 2 * rounds + 1);
+	if (floatCount > 0) floatParser.evaluate_batch_float(floatCount, floatValues.data());
+	rounds++;
+
+	size_t offset = 0, floatOffset = 0;
+	for (size_t p = 0; p < problems.size(); p++) {
+		if (problems[p]->finished()) continue;
+		size_t requested = problems[p]->ask().size();
+		vector<double> told(requested);
+		for (size_t i = 0; i < requested; i++) {
+			double value = problems[p]->approximate() ? floatValues[floatOffset + i] : values[offset + i];
+			told[i] = isfinite(value) ? value : numeric_limits<double>::infinity();
+		}
+		(problems[p]->approximate() ? floatOffset : offset) += requested;
+		problems[p]->tell(told);
+	}
+	handOffToDouble();
+	return true;
+}
+
+// Float keeps about seven digits, so once the simplex values agree to
+// roughly that many the problem continues in double.
+void batchNelderMead::handOffToDouble()
+{
+	const double resolution = 64 * numeric_limits<float>::epsilon();
+	for (size_t p = 0; p < problems.size(); p++) {
+		askTellNelderMead* problem = problems[p].get();
+		if (!problem->approximate() || problem->finished() || problem->simplex.size() != varsCount + 1) continue;
+		double best = min_element(problem->simplex.begin(), problem->simplex.end(),
+			[](const element& a, const element& b) {
+				return a.functionValue < b.functionValue;
+			}
+		)->functionValue;
+		if (problem->simplexSpread(problem->simplex) <= resolution * max(1.0, fabs(best))) {
+			problem->setApproximate(false);
+			problem->reevaluate();
+		}
+	}
+}
+
+vector<vector<double>> batchNelderMead::run()
+{
+	while (evaluateRound());
+	vector<vector<double>> results;
+	for (const auto& problem : problems)
+		results.push_back(problem->result());
+	return results;
+}
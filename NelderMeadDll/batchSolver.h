@@ -0,0 +1,49 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include "askTell.h"
+#include "tinyexpr.h"
+
+using namespace std;
+
+// Minimizes the same expression from several starting points at once.
+// The problems advance in lockstep: each round the points requested by all
+// unfinished problems are packed lane by lane (coordinate j of every point is
+// contiguous) and the expression tree is walked once for the whole batch.
+// Finished problems simply stop contributing lanes.
+//
+// With singlePrecision the problems start out evaluated in float, through a
+// second parser with its own lanes. A problem switches to double once the
+// spread of its simplex values nears float resolution, and its simplex is
+// evaluated again so that the rest of the search sees only double values.
+// A problem never finishes on float values: meeting the end criteria in
+// float hands it off to double as well.
+//
+// The expression may use parameters p1..pM, each problem with its own row
+// of values; they are stored as lanes after the variables, so a sweep is
+// parsed once for all problems.
+class batchNelderMead {
+private:
+	int varsCount;
+	int parametersCount;
+	vector<double> parameters;
+	size_t capacity;
+	vector<unique_ptr<askTellNelderMead>> problems;
+	vector<double> lanes;
+	vector<double> values;
+	te_parser parser;
+	vector<double> floatLanes;
+	vector<float> floatValues;
+	te_parser floatParser;
+	unsigned long long randomSeed;
+	uint64_t rounds = 0;
+
+	bool evaluateRound();
+	void handOffToDouble();
+
+public:
+	batchNelderMead(int problemsCount, int varsCount, double* startingPointsPtr, char* function, nelderMeadParams params,
+		int parametersCount = 0, const double* parametersPtr = nullptr);
+	vector<vector<double>> run();
+};
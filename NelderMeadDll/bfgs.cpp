@@ -0,0 +1,97 @@
+#include "pch.h"
+#include <cmath>
+#include "bfgs.h"
+#include "errors.h"
+
+static double dot(const vector<double>& a, const vector<double>& b) {
+	double sum = 0;
+	for (int i = 0; i < a.size(); i++) sum += a[i] * b[i];
+	return sum;
+}
+
+static bool isFinite(double value, const vector<double>& gradient) {
+	if (!isfinite(value)) return false;
+	for (double g : gradient)
+		if (!isfinite(g)) return false;
+	return true;
+}
+
+bfgsPolisher::bfgsPolisher(int varsCount, char* function, std::function<double(const double*)> objective):
+	varsCount(varsCount),
+	point(varsCount),
+	objective(move(objective))
+{
+	for (int i = 0; i < varsCount; i++)
+		variables.push_back(&point[i]);
+	parser.set_indexed_variables(point.data(), varsCount);
+	if (!parser.compile(function)) throw solverError(incorrectExpression, "Incorrect expression");
+}
+
+double bfgsPolisher::evaluate(const vector<double>& x, vector<double>& gradient)
+{
+	point = x;
+	parser.evaluate_gradient(variables, gradient);
+	return objective(point.data());
+}
+
+// Returns start unchanged when the expression cannot be differentiated there.
+vector<double> bfgsPolisher::minimize(vector<double> start, double gradientTolerance, int maxSteps)
+{
+	const double armijo = 1e-4;
+	vector<double> x = start, gradient;
+	double value = evaluate(x, gradient);
+	if (!isFinite(value, gradient)) return start;
+
+	// inverse Hessian approximation, row-major
+	vector<double> h(varsCount * varsCount);
+	auto resetHessian = [&] {
+		std::fill(h.begin(), h.end(), 0.0);
+		for (int i = 0; i < varsCount; i++) h[i * varsCount + i] = 1;
+	};
+	resetHessian();
+
+	vector<double> direction(varsCount), next(varsCount), nextGradient, s(varsCount), y(varsCount), hy(varsCount);
+	for (int k = 0; k < maxSteps && sqrt(dot(gradient, gradient)) > gradientTolerance; k++) {
+		for (int i = 0; i < varsCount; i++) {
+			direction[i] = 0;
+			for (int j = 0; j < varsCount; j++) direction[i] -= h[i * varsCount + j] * gradient[j];
+		}
+		double slope = dot(gradient, direction);
+		if (slope >= 0) {
+			resetHessian();
+			for (int i = 0; i < varsCount; i++) direction[i] = -gradient[i];
+			slope = -dot(gradient, gradient);
+		}
+
+		// backtracking line search
+		double step = 1, nextValue = 0;
+		bool accepted = false;
+		for (int t = 0; t < 60 && !accepted; t++, step /= 2) {
+			for (int i = 0; i < varsCount; i++) next[i] = x[i] + step * direction[i];
+			nextValue = evaluate(next, nextGradient);
+			accepted = isFinite(nextValue, nextGradient) && nextValue <= value + armijo * step * slope;
+		}
+		if (!accepted) break;
+
+		for (int i = 0; i < varsCount; i++) {
+			s[i] = next[i] - x[i];
+			y[i] = nextGradient[i] - gradient[i];
+		}
+		x = next;
+		value = nextValue;
+		gradient = nextGradient;
+
+		double sy = dot(s, y);
+		if (sy <= 1e-300) continue;
+		// H = (I - s y^T / sy) H (I - y s^T / sy) + s s^T / sy
+		for (int i = 0; i < varsCount; i++) {
+			hy[i] = 0;
+			for (int j = 0; j < varsCount; j++) hy[i] += h[i * varsCount + j] * y[j];
+		}
+		double yhy = dot(y, hy);
+		for (int i = 0; i < varsCount; i++)
+			for (int j = 0; j < varsCount; j++)
+				h[i * varsCount + j] += ((sy + yhy) * s[i] * s[j]) / (sy * sy) - (hy[i] * s[j] + s[i] * hy[j]) / sy;
+	}
+	return x;
+}
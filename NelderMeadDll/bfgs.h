@@ -0,0 +1,27 @@
+#pragma once
+
+#include <functional>
+#include <vector>
+#include "tinyexpr.h"
+
+using namespace std;
+
+// Quasi-Newton (BFGS) refinement of a point found by Nelder-Mead.
+// Gradients come from forward-mode differentiation of the compiled
+// expression, so no extra function evaluations are spent on them; the
+// values come from the solver's objective, native code and random streams
+// included.
+class bfgsPolisher {
+private:
+	int varsCount;
+	vector<double> point;
+	vector<const double*> variables;
+	te_parser parser;
+	function<double(const double*)> objective;
+
+	double evaluate(const vector<double>& x, vector<double>& gradient);
+
+public:
+	bfgsPolisher(int varsCount, char* function, std::function<double(const double*)> objective);
+	vector<double> minimize(vector<double> start, double gradientTolerance, int maxSteps);
+};
@@ -0,0 +1,143 @@
+#include "pch.h"
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include "checkpoint.h"
+
+static const char checkpointMagic[4] = { 'N', 'M', 'C', 'K' };
+static const uint32_t checkpointVersion = 1;
+
+template<typename T>
+static void put(vector<char>& buffer, const T& value) {
+	const char* bytes = reinterpret_cast<const char*>(&value);
+	buffer.insert(buffer.end(), bytes, bytes + sizeof(T));
+}
+
+static void putBytes(vector<char>& buffer, const void* data, size_t size) {
+	put(buffer, (uint32_t)size);
+	const char* bytes = static_cast<const char*>(data);
+	buffer.insert(buffer.end(), bytes, bytes + size);
+}
+
+vector<char> serializeCheckpoint(const checkpoint& state) {
+	vector<char> buffer(checkpointMagic, checkpointMagic + sizeof(checkpointMagic));
+	put(buffer, checkpointVersion);
+	put(buffer, (uint32_t)state.step);
+	put(buffer, (uint32_t)state.varsCount);
+	put(buffer, (uint32_t)state.simplex.size());
+	putBytes(buffer, state.function.data(), state.function.size());
+	putBytes(buffer, state.params.data(), state.params.size());
+	for (const element& vertex : state.simplex) {
+		for (double coordinate : vertex.point) put(buffer, coordinate);
+		put(buffer, vertex.functionValue);
+	}
+	return buffer;
+}
+
+class checkpointReader {
+private:
+	const vector<char>& buffer;
+	size_t position = 0;
+
+public:
+	checkpointReader(const vector<char>& buffer) : buffer(buffer) {}
+
+	void read(void* data, size_t size) {
+		expect(size);
+		memcpy(data, buffer.data() + position, size);
+		position += size;
+	}
+
+	// Lengths come from the file, so they are checked before anything is allocated.
+	void expect(size_t size) {
+		if (size > buffer.size() - position) throw solverError(incorrectArgument, "Incorrect checkpoint");
+	}
+
+	template<typename T>
+	T get() {
+		T value;
+		read(&value, sizeof(T));
+		return value;
+	}
+};
+
+checkpoint loadCheckpoint(const string& path) {
+	ifstream in(path, ios::binary);
+	if (!in) throw solverError(incorrectArgument, "Cannot open checkpoint " + path);
+	vector<char> buffer((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+	checkpointReader reader(buffer);
+	char magic[sizeof(checkpointMagic)];
+	reader.read(magic, sizeof(magic));
+	if (memcmp(magic, checkpointMagic, sizeof(magic)) != 0 || reader.get<uint32_t>() != checkpointVersion)
+		throw solverError(incorrectArgument, "Incorrect checkpoint");
+
+	checkpoint state;
+	state.step = reader.get<uint32_t>();
+	state.varsCount = reader.get<uint32_t>();
+	uint32_t verticesCount = reader.get<uint32_t>();
+	if (state.step < 0 || state.varsCount <= 0 || verticesCount != (uint32_t)state.varsCount + 1)
+		throw solverError(incorrectArgument, "Incorrect checkpoint");
+	// bounds varsCount by the file size before it is squared below
+	reader.expect((size_t)state.varsCount * sizeof(double));
+	uint32_t functionLength = reader.get<uint32_t>();
+	reader.expect(functionLength);
+	state.function.resize(functionLength);
+	reader.read(state.function.data(), state.function.size());
+	uint32_t paramsLength = reader.get<uint32_t>();
+	reader.expect(paramsLength);
+	state.params.resize(paramsLength);
+	reader.read(state.params.data(), state.params.size());
+	reader.expect((size_t)verticesCount * (state.varsCount + 1) * sizeof(double));
+	for (uint32_t i = 0; i < verticesCount; i++) {
+		vector<double> point(state.varsCount);
+		reader.read(point.data(), point.size() * sizeof(double));
+		double value = reader.get<double>();
+		state.simplex.push_back(element(move(point), value));
+	}
+	return state;
+}
+
+checkpointWriter::checkpointWriter(const string& path):
+	path(path),
+	worker(&checkpointWriter::writeSnapshots, this) {}
+
+checkpointWriter::~checkpointWriter()
+{
+	{
+		lock_guard<mutex> lock(buffersMutex);
+		stopping = true;
+	}
+	snapshotReady.notify_one();
+	worker.join();
+}
+
+void checkpointWriter::save(const checkpoint& state)
+{
+	vector<char> snapshot = serializeCheckpoint(state);
+	{
+		lock_guard<mutex> lock(buffersMutex);
+		back.swap(snapshot);
+		hasSnapshot = true;
+	}
+	snapshotReady.notify_one();
+}
+
+void checkpointWriter::writeSnapshots()
+{
+	unique_lock<mutex> lock(buffersMutex);
+	while (true) {
+		snapshotReady.wait(lock, [this] { return hasSnapshot || stopping; });
+		if (!hasSnapshot) return;
+		front.swap(back);
+		hasSnapshot = false;
+		lock.unlock();
+		// a failed write keeps the previous checkpoint; the run goes on
+		const string temporaryPath = path + ".tmp";
+		ofstream out(temporaryPath, ios::binary | ios::trunc);
+		out.write(front.data(), front.size());
+		out.close();
+		error_code error;
+		if (out) filesystem::rename(temporaryPath, path, error);
+		lock.lock();
+	}
+}
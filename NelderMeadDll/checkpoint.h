@@ -0,0 +1,53 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "neldermead.h"
+
+using namespace std;
+
+// Solver state at the top of a step, before the simplex is sorted, so that a
+// resumed run repeats exactly what the interrupted one would have done.
+struct checkpoint {
+	string function;
+	// nelderMeadParams encoded as CBOR
+	vector<uint8_t> params;
+	int step = 0;
+	int varsCount = 0;
+	vector<element> simplex;
+};
+
+// Layout, in native byte order: "NMCK", format version, step, varsCount,
+// vertex count, function and params as length-prefixed bytes, then every
+// vertex as varsCount coordinates followed by its value.
+vector<char> serializeCheckpoint(const checkpoint& state);
+checkpoint loadCheckpoint(const string& path);
+
+// Writes checkpoints on a background thread. save() only serializes into the
+// back buffer; the thread swaps it with the front buffer and writes that, so
+// the solver never waits for the disk. A snapshot not yet picked up is
+// replaced by a newer one. The file is replaced atomically through a
+// temporary file.
+class checkpointWriter {
+private:
+	string path;
+	mutex buffersMutex;
+	condition_variable snapshotReady;
+	vector<char> front;
+	vector<char> back;
+	bool hasSnapshot = false;
+	bool stopping = false;
+	thread worker;
+
+	void writeSnapshots();
+
+public:
+	checkpointWriter(const string& path);
+	// Waits until the last saved snapshot is on disk.
+	~checkpointWriter();
+	void save(const checkpoint& state);
+};
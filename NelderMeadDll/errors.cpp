@@ -0,0 +1,19 @@
+#include "pch.h"
+#include "errors.h"
+#include "neldermead.h"
+
+static thread_local errorCode lastErrorCode = noError;
+static thread_local string lastErrorMessage;
+
+void setLastError(errorCode code, const string& message) {
+	lastErrorCode = code;
+	lastErrorMessage = message;
+}
+
+int getLastErrorCode() {
+	return lastErrorCode;
+}
+
+const char* getLastErrorMessage() {
+	return lastErrorMessage.c_str();
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <exception>
+#include <stdexcept>
+#include <string>
+
+using namespace std;
+
+// Codes reported by getLastErrorCode(); the exported functions never let an
+// exception cross the C interface.
+enum errorCode {
+	noError = 0,
+	incorrectExpression = 1,
+	evaluationFailed = 2,
+	incorrectArgument = 3,
+	incorrectConfig = 4,
+	internalError = 5
+};
+
+class solverError : public runtime_error {
+public:
+	errorCode code;
+	solverError(errorCode code, const string& message) : runtime_error(message), code(code) {}
+};
+
+// The error of the last exported call made on this thread.
+void setLastError(errorCode code, const string& message);
+
+// Runs body on behalf of an exported function. An exception becomes the
+// thread's last error and failed is returned instead.
+template<typename T, typename F>
+T reportErrors(T failed, F body) {
+	setLastError(noError, "");
+	try {
+		return body();
+	}
+	catch (const solverError& e) {
+		setLastError(e.code, e.what());
+	}
+	catch (const exception& e) {
+		setLastError(internalError, e.what());
+	}
+	catch (...) {
+		setLastError(internalError, "Unknown error");
+	}
+	return failed;
+}
@@ -0,0 +1,183 @@
+#include "pch.h"
+#include <cctype>
+#include <limits>
+#include <shared_mutex>
+#include <unordered_map>
+#include "expressionCache.h"
+
+compiledExpression::compiledExpression(const string& expression, int varsCount, int parametersCount):
+	varsCount(varsCount),
+	parametersCount(parametersCount),
+	lastUse(0)
+{
+	// the parser only binds the names; the program reads the values from a context
+	vector<double> names(varsCount + parametersCount);
+	te_parser parser;
+	parser.set_indexed_variables(names.data(), names.size());
+	parser.set_indexed_parameters(parametersCount);
+	if (parser.compile(expression)) program = parser.get_program();
+}
+
+struct threadContext {
+	weak_ptr<const te_program> program;
+	te_context context;
+	bool busy = false;
+
+	threadContext(const shared_ptr<const te_program>& program) : program(program) {}
+};
+
+// The calling thread's contexts, by program; entries of programs that are
+// gone are dropped once there are more than the cache holds.
+static thread_local unordered_map<const te_program*, threadContext> threadContexts;
+
+static threadContext& findThreadContext(const shared_ptr<const te_program>& program)
+{
+	auto found = threadContexts.find(program.get());
+	if (found != threadContexts.end()) {
+		// another program may have been allocated where a dropped one was
+		if (found->second.program.expired()) found->second = threadContext(program);
+		return found->second;
+	}
+	if (threadContexts.size() >= compiledExpressionCacheSize)
+		erase_if(threadContexts, [](const auto& entry) { return entry.second.program.expired(); });
+	return threadContexts.emplace(program.get(), program).first->second;
+}
+
+compiledExpression::leasedContext::leasedContext(compiledExpression& owner):
+	owner(owner)
+{
+	threadContext& own = findThreadContext(owner.program);
+	if (!own.busy) {
+		own.busy = true;
+		busy = &own.busy;
+		context = &own.context;
+		return;
+	}
+	{
+		lock_guard<mutex> lock(owner.idleMutex);
+		if (!owner.idle.empty()) {
+			borrowed = move(owner.idle.back());
+			owner.idle.pop_back();
+		}
+	}
+	if (!borrowed) borrowed = make_unique<te_context>();
+	context = borrowed.get();
+}
+
+compiledExpression::leasedContext::~leasedContext()
+{
+	if (busy != nullptr) {
+		*busy = false;
+		return;
+	}
+	lock_guard<mutex> lock(owner.idleMutex);
+	owner.idle.push_back(move(borrowed));
+}
+
+bool compiledExpression::valid() const
+{
+	return program != nullptr;
+}
+
+int compiledExpression::variablesCount() const
+{
+	return varsCount;
+}
+
+double compiledExpression::evaluate(const double* point)
+{
+	if (program == nullptr) return numeric_limits<double>::quiet_NaN();
+	leasedContext context(*this);
+	context->set_variables(point);
+	double result = program->evaluate(*context);
+	return context->success() ? result : numeric_limits<double>::quiet_NaN();
+}
+
+vector<double> compiledExpression::evaluateCoordinateSteps(const double* point, double step)
+{
+	if (program == nullptr) return vector<double>(varsCount + 1, numeric_limits<double>::quiet_NaN());
+	vector<double> shifted(point, point + varsCount + parametersCount);
+	vector<double> values;
+	bool success;
+	{
+		leasedContext context(*this);
+		context->set_variables(shifted.data());
+		values.push_back(program->evaluate_base(*context));
+		for (int i = 0; i < varsCount && context->success(); i++) {
+			shifted[i] += step;
+			values.push_back(program->evaluate_changed(*context, i));
+			shifted[i] = point[i];
+		}
+		success = context->success();
+	}
+	if (success) return values;
+	// some point failed; find out which ones the slow way
+	values.assign(1, evaluate(point));
+	for (int i = 0; i < varsCount; i++) {
+		shifted[i] += step;
+		values.push_back(evaluate(shifted.data()));
+		shifted[i] = point[i];
+	}
+	return values;
+}
+
+static bool isNameChar(char ch) {
+	return isalnum((unsigned char)ch) || ch == '_' || ch == '.';
+}
+
+string normalizeExpression(const char* function) {
+	string text(function);
+	if (!text.empty() && text.front() == '=') text.erase(0, 1);
+	string normalized;
+	for (size_t i = 0; i < text.size(); i++) {
+		if (text[i] == '/' && i + 1 < text.size() && text[i + 1] == '*') {
+			size_t end = text.find("*/", i + 2);
+			// an unterminated comment is an error; keep it for compile to report
+			if (end == string::npos) return normalized + text.substr(i);
+			i = end + 1;
+		}
+		else if (text[i] == '/' && i + 1 < text.size() && text[i + 1] == '/') {
+			size_t end = text.find_first_of("\n\r", i);
+			if (end == string::npos) break;
+			i = end - 1;
+		}
+		else if (isspace((unsigned char)text[i])) {
+			size_t next = i;
+			while (next + 1 < text.size() && isspace((unsigned char)text[next + 1])) next++;
+			if (!normalized.empty() && next + 1 < text.size() && isNameChar(normalized.back()) && isNameChar(text[next + 1]))
+				normalized += ' ';
+			i = next;
+		}
+		else normalized += text[i];
+	}
+	return normalized;
+}
+
+static unordered_map<string, shared_ptr<compiledExpression>> compiledExpressions;
+static shared_mutex compiledExpressionsMutex;
+static atomic<uint64_t> useCounter(0);
+
+shared_ptr<compiledExpression> findCompiledExpression(const char* function, int varsCount, int parametersCount) {
+	string key = to_string(varsCount) + "," + to_string(parametersCount) + "#" + normalizeExpression(function);
+	{
+		shared_lock<shared_mutex> lock(compiledExpressionsMutex);
+		auto found = compiledExpressions.find(key);
+		if (found != compiledExpressions.end()) {
+			found->second->lastUse = ++useCounter;
+			return found->second;
+		}
+	}
+	// compile outside the lock; if another thread won the race, use its copy
+	shared_ptr<compiledExpression> compiled = make_shared<compiledExpression>(key.substr(key.find('#') + 1), varsCount, parametersCount);
+	compiled->lastUse = ++useCounter;
+	unique_lock<shared_mutex> lock(compiledExpressionsMutex);
+	auto inserted = compiledExpressions.emplace(key, compiled);
+	if (!inserted.second) return inserted.first->second;
+	if (compiledExpressions.size() > compiledExpressionCacheSize) {
+		auto oldest = compiledExpressions.begin();
+		for (auto it = compiledExpressions.begin(); it != compiledExpressions.end(); ++it)
+			if (it->second->lastUse < oldest->second->lastUse) oldest = it;
+		compiledExpressions.erase(oldest);
+	}
+	return compiled;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "tinyexpr.h"
+
+using namespace std;
+
+// An expression compiled once and shared by all threads. The compiled
+// program never changes; every thread evaluates it in an evaluation context
+// of its own, kept per program, so threads do not contend at all. Only a
+// thread that is already using its context borrows one from the idle list.
+class compiledExpression {
+private:
+	int varsCount;
+	int parametersCount;
+	shared_ptr<const te_program> program;
+	mutex idleMutex;
+	vector<unique_ptr<te_context>> idle;
+
+	// The context an evaluation works in for as long as it exists.
+	class leasedContext {
+	private:
+		compiledExpression& owner;
+		te_context* context;
+		unique_ptr<te_context> borrowed;
+		bool* busy = nullptr;
+
+	public:
+		leasedContext(compiledExpression& owner);
+		~leasedContext();
+		te_context* operator->() { return context; }
+		te_context& operator*() { return *context; }
+	};
+
+public:
+	atomic<uint64_t> lastUse;
+
+	// Points hold the varsCount variables followed by the values of the
+	// parametersCount parameters p1..pM.
+	compiledExpression(const string& expression, int varsCount, int parametersCount = 0);
+	// False when the expression did not compile.
+	bool valid() const;
+	int variablesCount() const;
+	// NaN when the expression is invalid or cannot be evaluated at point.
+	double evaluate(const double* point);
+	// Values at point and at each of the points with coordinate i shifted by
+	// step; only the parts of the expression depending on i are recomputed.
+	// Values that cannot be evaluated are NaN.
+	vector<double> evaluateCoordinateSteps(const double* point, double step);
+};
+
+// Maximum number of distinct expressions kept compiled.
+const size_t compiledExpressionCacheSize = 64;
+
+// Strips what te_parser::compile ignores: a leading '=', comments and
+// whitespace that does not separate two names or numbers.
+string normalizeExpression(const char* function);
+
+// Returns the compiled expression for function, compiling it on first use.
+// Least recently used expressions are dropped once the cache is full.
+shared_ptr<compiledExpression> findCompiledExpression(const char* function, int varsCount, int parametersCount = 0);
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <array>
+#include <algorithm>
+#include <cmath>
+#include <utility>
+#include "neldermead.h"
+
+using namespace std;
+
+// Nelder-Mead for a dimension known at compile time. Points are std::array,
+// so the simplex lives on the stack and the per-coordinate loops unroll.
+// Performs exactly the same steps as nelderMead::run and reports through the
+// owner's params, output and callback.
+template<int N>
+class fixedNelderMead {
+private:
+	typedef array<double, N> point;
+	struct vertex {
+		point x;
+		double functionValue;
+	};
+
+	nelderMead& owner;
+	nelderMeadParams& params;
+	nelderMeadStep step;
+	array<vertex, N + 1> simplex;
+
+	vertex makeVertex(const point& x) {
+		vertex result{ x, 0 };
+		result.functionValue = owner.evaluateObjective(result.x.data());
+		return result;
+	}
+
+	static point affineCombination(const point& c, const point& p, double t) {
+		point result;
+		for (int j = 0; j < N; j++)
+			result[j] = c[j] + t * (p[j] - c[j]);
+		return result;
+	}
+
+	void makeStartSimplex(const double* startingPointPtr) {
+		point startingPoint;
+		std::copy(startingPointPtr, startingPointPtr + N, startingPoint.begin());
+		vector<double> values = owner.evaluateCoordinateSteps(startingPointPtr, N, params.scale);
+		simplex[0] = { startingPoint, values[0] };
+		for (int i = 0; i < N; i++) {
+			point newPoint = startingPoint;
+			newPoint[i] += params.scale;
+			simplex[i + 1] = { newPoint, values[i + 1] };
+		}
+	}
+
+	point calculateMassCenter() {
+		point massCenter{};
+		for (int i = 0; i < N; i++)
+			for (int j = 0; j < N; j++)
+				massCenter[j] = massCenter[j] + simplex[i].x[j] / (double)N;
+		return massCenter;
+	}
+
+	bool endCheck() {
+		double sum = 0;
+		for (int i = 1; i < N + 1; i++)
+			sum += pow(simplex[i].functionValue - simplex[0].functionValue, 2);
+		return sqrt(sum / N) <= params.eps;
+	}
+
+	void changeSimplex() {
+		point massCenter = calculateMassCenter();
+		vertex& worst = simplex[N];
+		vertex reflection = makeVertex(affineCombination(massCenter, worst.x, step.reflection));
+		owner.logPoint(nelderMead::reflectionLabel, reflection.x.data(), N);
+		nelderMeadStep::outcome outcome = nelderMeadStep::afterReflection(reflection.functionValue, simplex[0].functionValue, simplex[N - 1].functionValue);
+		if (outcome == nelderMeadStep::acceptReflection) {
+			worst = reflection;
+		}
+		else if (outcome == nelderMeadStep::tryExpansion) {
+			vertex expansion = makeVertex(affineCombination(massCenter, reflection.x, step.expansion));
+			owner.logPoint(nelderMead::expansionLabel, expansion.x.data(), N);
+			worst = nelderMeadStep::isExpansionAccepted(expansion.functionValue, reflection.functionValue) ? expansion : reflection;
+		}
+		else {
+			const point& towards = nelderMeadStep::contractsTowardsVertex(worst.functionValue, reflection.functionValue) ? worst.x : reflection.x;
+			vertex contraction = makeVertex(affineCombination(massCenter, towards, step.contraction));
+			owner.logPoint(nelderMead::contractionLabel, contraction.x.data(), N);
+			if (nelderMeadStep::isContractionAccepted(contraction.functionValue, worst.functionValue, reflection.functionValue))
+				worst = contraction;
+			else globalContraction();
+		}
+	}
+
+	void globalContraction() {
+		for (int i = 1; i < N + 1; i++)
+			simplex[i] = makeVertex(affineCombination(simplex[i].x, simplex[0].x, nelderMeadStep::shrink));
+	}
+
+	void logSimplex(int k) {
+		string data;
+		for (int i = 0; i < N + 1; i++) {
+			data += owner.printVector(simplex[i].x.data(), N, i);
+			if (i < N) data += ", ";
+		}
+		owner.logStep(k, data);
+	}
+
+public:
+	fixedNelderMead(nelderMead& owner) : owner(owner), params(owner.params), step(owner.params) {}
+
+	vector<double> run(double* startingPointPtr) {
+		makeStartSimplex(startingPointPtr);
+		for (int k = 0; k < params.maxSteps; k++) {
+			std::sort(simplex.begin(), simplex.end(),
+				[](const vertex& a, const vertex& b) {
+					return a.functionValue < b.functionValue;
+				}
+			);
+			if (owner.callback != nullptr)
+				for (int i = 0; i < N + 1; i++) owner.callback(simplex[i].x.data());
+			if (endCheck()) break;
+			logSimplex(k);
+			changeSimplex();
+		}
+		return vector<double>(simplex[0].x.begin(), simplex[0].x.end());
+	}
+};
+
+typedef vector<double> (*fixedNelderMeadRun)(nelderMead& owner, double* startingPointPtr);
+
+const int maxFixedDimension = 16;
+
+template<int N>
+vector<double> runFixedNelderMead(nelderMead& owner, double* startingPointPtr) {
+	return fixedNelderMead<N>(owner).run(startingPointPtr);
+}
+
+// Entry i runs the specialization for i variables; entry 0 is unused.
+template<int... N>
+array<fixedNelderMeadRun, sizeof...(N) + 1> makeFixedNelderMeadTable(integer_sequence<int, N...>) {
+	return { nullptr, &runFixedNelderMead<N + 1>... };
+}
+
+const array<fixedNelderMeadRun, maxFixedDimension + 1> fixedNelderMeadTable =
+	makeFixedNelderMeadTable(make_integer_sequence<int, maxFixedDimension>());
@@ -12,10 +12,33 @@ void to_json(nlohmann::json& j, const nelderMeadParams& p) {
 		{"scale", p.scale},
 		{"eps", p.eps},
 		{"maxSteps", p.maxSteps},
-		{"outputType", p.outputType}
+		{"outputType", p.outputType},
+		{"parallelVertices", p.parallelVertices},
+		{"threads", p.threads},
+		{"method", p.method},
+		{"speculative", p.speculative},
+		{"polish", p.polish},
+		{"polishTolerance", p.polishTolerance},
+		{"nativeCode", p.nativeCode},
+		{"randomSeed", p.randomSeed},
+		{"singlePrecision", p.singlePrecision},
+		{"lowerBounds", p.lowerBounds},
+		{"upperBounds", p.upperBounds},
+		{"constraints", p.constraints},
+		{"checkpointInterval", p.checkpointInterval},
+		{"checkpointFile", p.checkpointFile}
 	};
 }
 
+// Infinite bounds are written as null.
+vector<double> boundsFromJson(const nlohmann::json& j, const string& key, double unbounded) {
+	vector<double> bounds;
+	if (!j.contains(key)) return bounds;
+	for (const nlohmann::json& bound : j.at(key))
+		bounds.push_back(bound.is_null() ? unbounded : bound.get<double>());
+	return bounds;
+}
+
 void from_json(const nlohmann::json& j, nelderMeadParams& p) {
 	j.at("reflectionCoeff").get_to(p.reflectionCoeff);
 	j.at("contractionCoeff").get_to(p.contractionCoeff);
@@ -24,6 +47,20 @@ void from_json(const nlohmann::json& j, nelderMeadParams& p) {
 	j.at("eps").get_to(p.eps);
 	j.at("maxSteps").get_to(p.maxSteps);
 	j.at("outputType").get_to(p.outputType);
+	p.parallelVertices = j.value("parallelVertices", p.parallelVertices);
+	p.threads = j.value("threads", p.threads);
+	p.method = j.value("method", p.method);
+	p.speculative = j.value("speculative", p.speculative);
+	p.polish = j.value("polish", p.polish);
+	p.polishTolerance = j.value("polishTolerance", p.polishTolerance);
+	p.nativeCode = j.value("nativeCode", p.nativeCode);
+	p.randomSeed = j.value("randomSeed", p.randomSeed);
+	p.singlePrecision = j.value("singlePrecision", p.singlePrecision);
+	p.lowerBounds = boundsFromJson(j, "lowerBounds", -numeric_limits<double>::infinity());
+	p.upperBounds = boundsFromJson(j, "upperBounds", numeric_limits<double>::infinity());
+	p.constraints = j.value("constraints", p.constraints);
+	p.checkpointInterval = j.value("checkpointInterval", p.checkpointInterval);
+	p.checkpointFile = j.value("checkpointFile", p.checkpointFile);
 }
 
 nelderMeadParams loadConfig(string filename = "config.json") {
@@ -36,7 +73,14 @@ nelderMeadParams loadConfig(string filename = "config.json") {
 		in.close();
 	}
 	catch (...) {
-		params = { 1.0, 0.5, 2.0, 1.0, 0.001, 500, "txt" };
+		params = nelderMeadParams();
+		params.reflectionCoeff = 1.0;
+		params.contractionCoeff = 0.5;
+		params.expansionCoeff = 2.0;
+		params.scale = 1.0;
+		params.eps = 0.001;
+		params.maxSteps = 500;
+		params.outputType = "txt";
 		nlohmann::json j = params;
 		ofstream output(filename);
 		output << j.dump(4);
@@ -0,0 +1,117 @@
+#include "pch.h"
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <random>
+#include <shared_mutex>
+#include "nativeExpression.h"
+#include "tinyexpr.h"
+#ifndef _WIN32
+#include <dlfcn.h>
+#endif
+
+static const string nativeCacheDirectory = "nativeCache";
+
+// expression + "#" + varsCount -> loaded function; nullptr marks expressions
+// that could not be compiled, so they are not retried
+static map<string, nativeFunction, less<>> nativeFunctions;
+static shared_mutex nativeFunctionsMutex;
+
+static string nativeFunctionKey(const char* function, int varsCount) {
+	return string(function) + "#" + to_string(varsCount);
+}
+
+static uint64_t fnv1a(const string& data) {
+	uint64_t hash = 14695981039346656037ULL;
+	for (unsigned char ch : data) {
+		hash ^= ch;
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+static nativeFunction loadNativeFunction(const string& libraryPath) {
+#ifdef _WIN32
+	HMODULE library = LoadLibraryA(libraryPath.c_str());
+	if (library == nullptr) return nullptr;
+	return (nativeFunction)GetProcAddress(library, "evaluate");
+#else
+	void* library = dlopen(libraryPath.c_str(), RTLD_NOW | RTLD_LOCAL);
+	if (library == nullptr) return nullptr;
+	return (nativeFunction)dlsym(library, "evaluate");
+#endif
+}
+
+static bool compileNativeLibrary(const string& sourcePath, const string& libraryPath) {
+#ifdef _WIN32
+	const string commands[] = {
+		"cl /nologo /O2 /fp:precise /LD \"" + sourcePath + "\" /Fe:\"" + libraryPath + "\" > nul 2>&1",
+		"gcc -O2 -ffp-contract=off -shared -o \"" + libraryPath + "\" \"" + sourcePath + "\" > nul 2>&1"
+	};
+#else
+	const string commands[] = {
+		"cc -O2 -ffp-contract=off -shared -fPIC -o \"" + libraryPath + "\" \"" + sourcePath + "\" -lm > /dev/null 2>&1"
+	};
+#endif
+	for (const string& command : commands)
+		if (system(command.c_str()) == 0 && filesystem::exists(libraryPath)) return true;
+	return false;
+}
+
+// Libraries are kept loaded for the lifetime of the process.
+static nativeFunction buildNativeFunction(const char* function, int varsCount) {
+	vector<double> point(varsCount);
+	te_parser parser;
+	parser.set_indexed_variables(point.data(), varsCount);
+	string body;
+	if (!parser.compile(function) || !parser.generate_c_source(body)) return nullptr;
+
+	string source =
+		"#include <math.h>\n"
+		"#ifdef _WIN32\n__declspec(dllexport)\n#endif\n"
+		"double evaluate(const double* x) {\n" + body + "}\n";
+	char name[32];
+	snprintf(name, sizeof(name), "expr_%016llx", (unsigned long long)fnv1a(source));
+#ifdef _WIN32
+	const string libraryExtension = ".dll";
+#else
+	const string libraryExtension = ".so";
+#endif
+	error_code error;
+	filesystem::create_directories(nativeCacheDirectory, error);
+	const string basePath = nativeCacheDirectory + "/" + name;
+	const string libraryPath = basePath + libraryExtension;
+	if (!filesystem::exists(libraryPath)) {
+		// build under a unique name and rename it into place, so that another
+		// process never loads a half-written library
+		char suffix[16];
+		snprintf(suffix, sizeof(suffix), "-%08x", (unsigned int)random_device()());
+		const string temporaryPath = basePath + suffix;
+		ofstream(temporaryPath + ".c") << source;
+		if (compileNativeLibrary(temporaryPath + ".c", temporaryPath + libraryExtension))
+			filesystem::rename(temporaryPath + libraryExtension, libraryPath, error);
+		// on Windows the rename fails if a concurrent build got there first; its
+		// library is as good
+		filesystem::remove(temporaryPath + libraryExtension, error);
+		filesystem::rename(temporaryPath + ".c", basePath + ".c", error);
+		filesystem::remove(temporaryPath + ".c", error);
+		if (!filesystem::exists(libraryPath)) return nullptr;
+	}
+	return loadNativeFunction(filesystem::absolute(libraryPath).string());
+}
+
+nativeFunction prepareNativeFunction(const char* function, int varsCount) {
+	string key = nativeFunctionKey(function, varsCount);
+	{
+		shared_lock<shared_mutex> lock(nativeFunctionsMutex);
+		auto found = nativeFunctions.find(key);
+		if (found != nativeFunctions.end()) return found->second;
+	}
+	nativeFunction native = buildNativeFunction(function, varsCount);
+	unique_lock<shared_mutex> lock(nativeFunctionsMutex);
+	return nativeFunctions.emplace(key, native).first->second;
+}
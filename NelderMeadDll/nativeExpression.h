@@ -0,0 +1,14 @@
+#pragma once
+
+#include <string>
+
+using namespace std;
+
+typedef double (*nativeFunction)(const double* point);
+
+// Translates the expression to C, compiles it with the local C compiler into
+// a shared library under nativeCache/ (reused on later runs) and loads it.
+// Returns nullptr, leaving evaluation to the interpreter, if the expression
+// cannot be translated or no compiler is available. Only the solver that
+// asked for native code uses the result.
+nativeFunction prepareNativeFunction(const char* function, int varsCount);
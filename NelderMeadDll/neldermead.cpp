@@ -1,31 +1,105 @@
 #include <iostream>
 #include <fstream>
 #include "pch.h"
+#include <cstring>
 #include "neldermead.h"
+#include "fixedNelderMead.h"
+#include "batchSolver.h"
+#include "bfgs.h"
+#include "checkpoint.h"
+#include "nativeExpression.h"
+#include "expressionCache.h"
 #include "vectorOps.h"
 #include "jsonSerializer.h"
 #include "tinyexpr.h"
 
 double* findFunctionMinimum(pointsCallback callback, int varsCount, double* startingPointPtr, char* function) {
-	nelderMead* nelderMeadMethod = new nelderMead(callback, function);
-	vector<double> resultPoint = nelderMeadMethod->start(varsCount, startingPointPtr);
-	double* res = new double[varsCount];
-	std::copy(resultPoint.begin(), resultPoint.end(), res);
-	return res;
+	return reportErrors<double*>(nullptr, [&] {
+		unique_ptr<nelderMead> nelderMeadMethod(chooseMethod(callback, function));
+		vector<double> resultPoint = nelderMeadMethod->start(varsCount, startingPointPtr);
+		double* res = new double[varsCount];
+		std::copy(resultPoint.begin(), resultPoint.end(), res);
+		return res;
+	});
+}
+
+// startingPointsPtr holds problemsCount points of varsCount values each;
+// the result has the same layout.
+double* findFunctionMinimumBatch(int problemsCount, int varsCount, double* startingPointsPtr, char* function) {
+	return findFunctionMinimumSweep(problemsCount, varsCount, startingPointsPtr, 0, nullptr, function);
+}
+
+double* findFunctionMinimumSweep(int problemsCount, int varsCount, double* startingPointsPtr, int parametersCount, double* parametersPtr, char* function) {
+	return reportErrors<double*>(nullptr, [&] {
+		if (problemsCount <= 0 || varsCount <= 0) throw solverError(incorrectArgument, "Incorrect problems count");
+		if (parametersCount < 0 || (parametersCount > 0 && parametersPtr == nullptr)) throw solverError(incorrectArgument, "Incorrect parameters");
+		batchNelderMead batch(problemsCount, varsCount, startingPointsPtr, function, loadConfig(), parametersCount, parametersPtr);
+		vector<vector<double>> resultPoints = batch.run();
+		double* res = new double[problemsCount * varsCount];
+		for (int i = 0; i < problemsCount; i++)
+			std::copy(resultPoints[i].begin(), resultPoints[i].end(), res + i * varsCount);
+		return res;
+	});
+}
+
+double* findFunctionMinimumFromSimplex(pointsCallback callback, int varsCount, double* simplexPtr, double* valuesPtr, char* function) {
+	return reportErrors<double*>(nullptr, [&] {
+		if (simplexPtr == nullptr) throw solverError(incorrectArgument, "Incorrect simplex");
+		unique_ptr<nelderMead> nelderMeadMethod(chooseMethod(callback, function));
+		vector<double> resultPoint = nelderMeadMethod->startFromSimplex(varsCount, simplexPtr, valuesPtr);
+		const vector<element>& simplex = nelderMeadMethod->simplex;
+		for (int i = 0; i < simplex.size(); i++) {
+			std::copy(simplex[i].point.begin(), simplex[i].point.end(), simplexPtr + i * varsCount);
+			if (valuesPtr != nullptr) valuesPtr[i] = simplex[i].functionValue;
+		}
+		double* res = new double[varsCount];
+		std::copy(resultPoint.begin(), resultPoint.end(), res);
+		return res;
+	});
+}
+
+double* resumeFunctionMinimum(pointsCallback callback, char* checkpointPath) {
+	return reportErrors<double*>(nullptr, [&] {
+		checkpoint state = loadCheckpoint(checkpointPath);
+		nelderMeadParams params;
+		try {
+			params = nlohmann::json::from_cbor(state.params).get<nelderMeadParams>();
+		}
+		catch (const nlohmann::json::exception&) {
+			throw solverError(incorrectArgument, "Incorrect checkpoint");
+		}
+		unique_ptr<nelderMead> nelderMeadMethod(chooseMethod(callback, state.function.data(), params));
+		vector<double> resultPoint = nelderMeadMethod->resume(state);
+		double* res = new double[resultPoint.size()];
+		std::copy(resultPoint.begin(), resultPoint.end(), res);
+		return res;
+	});
 }
 
 double evaluateFunction(double* pointPtr, int size, char* function) {
-	te_parser tep;
-	set<te_variable> variables;
-	vector<double> point(pointPtr, pointPtr + size);
-	for (int i = 0; i < point.size(); i++)
-		variables.insert({ "x" + to_string(i + 1), &point[i] });
-	tep.set_variables_and_functions(variables);
-	double result = tep.evaluate(function);
-    if (!tep.success()) throw runtime_error("Incorrect expression");
-	return result;
+	return reportErrors(numeric_limits<double>::quiet_NaN(), [&] {
+		shared_ptr<compiledExpression> compiled = findCompiledExpression(function, size);
+		if (!compiled->valid()) throw solverError(incorrectExpression, "Incorrect expression");
+		double result = compiled->evaluate(pointPtr);
+		if (isnan(result)) setLastError(evaluationFailed, "The function is undefined at the point");
+		return result;
+	});
 }
 
+double evaluateFunctionWithParameters(double* pointPtr, int size, double* parametersPtr, int parametersCount, char* function) {
+	return reportErrors(numeric_limits<double>::quiet_NaN(), [&] {
+		if (size <= 0 || parametersCount < 0) throw solverError(incorrectArgument, "Incorrect parameters");
+		shared_ptr<compiledExpression> compiled = findCompiledExpression(function, size, parametersCount);
+		if (!compiled->valid()) throw solverError(incorrectExpression, "Incorrect expression");
+		vector<double> values(pointPtr, pointPtr + size);
+		values.insert(values.end(), parametersPtr, parametersPtr + parametersCount);
+		double result = compiled->evaluate(values.data());
+		if (isnan(result)) setLastError(evaluationFailed, "The function is undefined at the point");
+		return result;
+	});
+}
+
+
 writer* nelderMead::chooseOutput() {
 	if (params.outputType == "txt") {
 		return new txtWriter("log");
@@ -33,20 +107,259 @@ writer* nelderMead::chooseOutput() {
 	else if (params.outputType == "html") {
 		return new htmlWriter("log");
 	}
-	else throw runtime_error("Incorrect output type");
+	else if (params.outputType == "none") {
+		return new nullWriter();
+	}
+	else throw solverError(incorrectConfig, "Incorrect output type");
+}
+
+const string nelderMead::reflectionLabel = ": ";
+const string nelderMead::expansionLabel = ": ";
+const string nelderMead::contractionLabel = ": ";
+const string nelderMead::bestLabel = " : ";
+
+nelderMead* chooseMethod(pointsCallback callback, char* function) {
+	return chooseMethod(callback, function, loadConfig());
+}
+
+nelderMead* chooseMethod(pointsCallback callback, char* function, nelderMeadParams params) {
+	if (params.method == "nelderMead") {
+		return new nelderMead(callback, function, params);
+	}
+	else if (params.method == "multidirectional") {
+		return new multidirectionalSearch(callback, function, params);
+	}
+	else throw solverError(incorrectConfig, "Incorrect method");
 }
 
-nelderMead::nelderMead(pointsCallback callback, char* function):
-	params(loadConfig()),
+threadPool* nelderMead::choosePool() {
+	if (params.parallelVertices > 1 || params.speculative || params.method == "multidirectional") {
+		return new threadPool(params.threads);
+	}
+	return nullptr;
+}
+
+nelderMead::nelderMead(pointsCallback callback, char* function, bool usePool):
+	nelderMead(callback, function, loadConfig(), usePool) {}
+
+nelderMead::nelderMead(pointsCallback callback, char* function, nelderMeadParams params, bool usePool):
+	params(params),
 	output(chooseOutput()),
+	pool(usePool ? choosePool() : nullptr),
 	callback(callback),
 	function(function) {}
 
+nelderMead::~nelderMead()
+{
+	delete pool;
+	delete output;
+}
+
 vector<double> nelderMead::start(int varsCount, double* startingPointPtr)
+{
+	vector<double> result;
+	prepare(varsCount);
+	if (canRunFixed(varsCount))
+		result = fixedNelderMeadTable[varsCount](*this, startingPointPtr);
+	else result = run(varsCount, startingPointPtr);
+	return finish(result);
+}
+
+vector<double> nelderMead::startFromSimplex(int varsCount, const double* simplexPtr, const double* valuesPtr)
+{
+	prepare(varsCount);
+	simplex.clear();
+	for (int i = 0; i <= varsCount; i++) {
+		vector<double> point(simplexPtr + i * varsCount, simplexPtr + (i + 1) * varsCount);
+		vector<double> projected(point);
+		projectToBounds(projected);
+		// a supplied value only stands for a vertex that is inside the box
+		if (valuesPtr == nullptr || projected != point || !isFeasible(point)) simplex.push_back(evaluatePoint(move(projected)));
+		else simplex.push_back(element(move(point), isfinite(valuesPtr[i]) ? valuesPtr[i] : numeric_limits<double>::infinity()));
+	}
+	vector<double> result = finish(iterate(0));
+	// the simplex is handed back, so the polished point replaces the best vertex
+	if (result != simplex.front().point) simplex.front() = element(result, evaluateObjective(result.data()));
+	return result;
+}
+
+vector<double> nelderMead::resume(const checkpoint& state)
+{
+	prepare(state.varsCount);
+	simplex = state.simplex;
+	return finish(iterate(state.step));
+}
+
+void nelderMead::prepare(int varsCount)
+{
+	if (varsCount <= 0) throw solverError(incorrectArgument, "Incorrect number of variables");
+	// with more than half of the vertices replaced at once the centroid of the
+	// kept ones is too poor a direction and the simplex collapses early
+	if (params.parallelVertices < 1 || params.parallelVertices > max(1, varsCount / 2))
+		throw solverError(incorrectConfig, "Incorrect parallelVertices");
+	// resolved once, so that the evaluations during the search neither look
+	// the expression up nor can fail
+	expression = findCompiledExpression(function, varsCount);
+	if (!expression->valid()) throw solverError(incorrectExpression, "Incorrect expression");
+	checkBounds(varsCount);
+	prepareConstraints(varsCount);
+	native = params.nativeCode ? prepareNativeFunction(function, varsCount) : nullptr;
+}
+
+vector<double> nelderMead::finish(vector<double> result)
+{
+	int varsCount = result.size();
+	// the simplex has converged; finish a smooth objective with gradient steps
+	if (params.polish) {
+		bfgsPolisher polisher(varsCount, function, [this](const double* point) { return evaluateObjective(point); });
+		vector<double> polished = polisher.minimize(result, params.polishTolerance, params.maxSteps);
+		// gradient steps ignore the box and the constraints; keep the projection
+		// only if it is feasible and no worse
+		projectToBounds(polished);
+		if (isFeasible(polished) && evaluateObjective(polished.data()) <= evaluateObjective(result.data()))
+			result = polished;
+	}
+	output->write(bestLabel + printVector(result, -1));
+	output->closeFile();
+	return result;
+}
+
+void nelderMead::checkBounds(int varsCount)
+{
+	if (params.lowerBounds.size() > varsCount || params.upperBounds.size() > varsCount)
+		throw solverError(incorrectConfig, "Incorrect number of bounds");
+	for (int i = 0; i < params.lowerBounds.size() && i < params.upperBounds.size(); i++)
+		if (!(params.lowerBounds[i] <= params.upperBounds[i])) throw solverError(incorrectConfig, "Incorrect bounds");
+}
+
+bool nelderMead::hasBounds()
+{
+	return !params.lowerBounds.empty() || !params.upperBounds.empty();
+}
+
+bool nelderMead::hasCheckpoints()
+{
+	return params.checkpointInterval > 0 && !params.checkpointFile.empty();
+}
+
+void nelderMead::projectToBounds(vector<double>& point)
+{
+	for (int i = 0; i < params.lowerBounds.size(); i++)
+		point[i] = max(point[i], params.lowerBounds[i]);
+	for (int i = 0; i < params.upperBounds.size(); i++)
+		point[i] = min(point[i], params.upperBounds[i]);
+}
+
+// c + t * (p - c), projected into the box so that no evaluation is spent
+// outside it.
+vector<double> nelderMead::trialPoint(const vector<double>& c, const vector<double>& p, double t)
+{
+	vector<double> result = affineCombination(c, p, t);
+	projectToBounds(result);
+	return result;
+}
+
+// The starting point shifted by scale along axis i, backwards when there is
+// more room below than above.
+vector<double> nelderMead::startingVertex(const vector<double>& startingPoint, int i)
+{
+	vector<double> vertex(startingPoint);
+	double above = i < params.upperBounds.size() ? params.upperBounds[i] - vertex[i] : params.scale;
+	double below = i < params.lowerBounds.size() ? vertex[i] - params.lowerBounds[i] : params.scale;
+	vertex[i] += above < params.scale && below > above ? -params.scale : params.scale;
+	projectToBounds(vertex);
+	return vertex;
+}
+
+void nelderMead::prepareConstraints(int varsCount)
+{
+	constraints.clear();
+	for (const string& constraint : params.constraints) {
+		constraints.push_back(findCompiledExpression(constraint.c_str(), varsCount));
+		if (!constraints.back()->valid()) throw solverError(incorrectConfig, "Incorrect constraint: " + constraint);
+	}
+}
+
+// A point is feasible when every constraint evaluates to a nonzero number.
+bool nelderMead::isFeasible(const vector<double>& point)
+{
+	for (const shared_ptr<compiledExpression>& constraint : constraints) {
+		double value = constraint->evaluate(point.data());
+		if (isnan(value) || value == 0) return false;
+	}
+	return true;
+}
+
+// With a fixed seed the random stream follows from the point, so a stochastic
+// objective gives the same run whichever pool thread evaluates what.
+static uint64_t pointStream(const double* point, size_t size) {
+	uint64_t hash = 14695981039346656037ULL;
+	for (size_t i = 0; i < size; i++) {
+		uint64_t bits;
+		memcpy(&bits, &point[i], sizeof(bits));
+		hash = (hash ^ bits) * 1099511628211ULL;
+	}
+	return hash;
+}
+
+double nelderMead::evaluateObjective(const double* point)
+{
+	if (params.randomSeed != 0) te_parser::set_random_stream(params.randomSeed, pointStream(point, expression->variablesCount()));
+	double result = native != nullptr ? native(point) : numeric_limits<double>::quiet_NaN();
+	// NaN is also how native code reports an error; an infinite value stands
+	if (isnan(result)) result = expression->evaluate(point);
+	return isfinite(result) ? result : numeric_limits<double>::infinity();
+}
+
+// Values at the point and at the points with one coordinate shifted by step.
+vector<double> nelderMead::evaluateCoordinateSteps(const double* point, int size, double step)
+{
+	// the incremental path draws the random numbers of all points from one stream
+	if (native == nullptr && params.randomSeed == 0) {
+		vector<double> values = expression->evaluateCoordinateSteps(point, step);
+		for (double& value : values)
+			if (!isfinite(value)) value = numeric_limits<double>::infinity();
+		return values;
+	}
+	vector<double> shifted(point, point + size);
+	vector<double> values(1, evaluateObjective(shifted.data()));
+	for (int i = 0; i < size; i++) {
+		shifted[i] += step;
+		values.push_back(evaluateObjective(shifted.data()));
+		shifted[i] = point[i];
+	}
+	return values;
+}
+
+// Infeasible points get +inf without evaluating the function.
+element nelderMead::evaluatePoint(vector<double> point)
+{
+	double value = isFeasible(point) ? evaluateObjective(point.data()) : numeric_limits<double>::infinity();
+	return element(move(point), value);
+}
+
+// Small problems of the classic method go to the stack-allocated
+// fixedNelderMead<N> instantiations; everything else uses run().
+bool nelderMead::canRunFixed(int varsCount)
+{
+	return varsCount >= 1 && varsCount <= maxFixedDimension && params.parallelVertices <= 1 && !params.speculative && !hasBounds() && params.constraints.empty() &&
+		!hasCheckpoints();
+}
+
+vector<double> nelderMead::run(int varsCount, double* startingPointPtr)
 {
 	vector<double> startingPoint(startingPointPtr, startingPointPtr + varsCount);
 	makeStartSimplex(varsCount, startingPoint);
-	for (int k = 0; k < params.maxSteps; k++) {
+	return iterate(0);
+}
+
+// The main loop from step firstStep on, with the simplex already evaluated.
+vector<double> nelderMead::iterate(int firstStep)
+{
+	unique_ptr<checkpointWriter> checkpoints;
+	if (hasCheckpoints()) checkpoints = make_unique<checkpointWriter>(params.checkpointFile);
+	for (int k = firstStep; k < params.maxSteps; k++) {
+		if (checkpoints && k % params.checkpointInterval == 0) checkpoints->save(makeCheckpoint(k));
 		std::sort(simplex.begin(), simplex.end(),
 			[](const element& a, const element& b) {
 				return a.functionValue < b.functionValue;
@@ -57,78 +370,182 @@ vector<double> nelderMead::start(int varsCount, double* startingPointPtr)
 		logSimplex(k);
 		changeSimplex();
 	}
-	output->write(" : " + printVector(simplex.front().point, -1));
-	output->closeFile();
 	return simplex.front().point;
 }
 
+checkpoint nelderMead::makeCheckpoint(int step)
+{
+	checkpoint state;
+	state.function = function;
+	state.params = nlohmann::json::to_cbor(nlohmann::json(params));
+	state.step = step;
+	state.varsCount = simplex.front().point.size();
+	state.simplex = simplex;
+	return state;
+}
+
 void nelderMead::changeSimplex()
 {
-	vector<double> massCenter = calculateMassCenter();
-	element reflection = element(massCenter * (1 + params.reflectionCoeff) - simplex.back().point * params.reflectionCoeff, function);
-	output->write(": " + printVector(reflection.point, -1));
-	if (isReflectionAcceptable(reflection)) {
-		simplex.back() = reflection;
+	int worstCount = min(params.parallelVertices, (int)simplex.size() - 1);
+	if (worstCount > 1) {
+		changeSimplexParallel(worstCount);
+		return;
 	}
-	else if (isExpansionNeeded(reflection)) {
-		performExpansion(massCenter, reflection);
+	if (params.speculative) {
+		changeSimplexSpeculative();
+		return;
+	}
+	int keptCount = simplex.size() - 1;
+	vector<double> massCenter = calculateMassCenter(keptCount);
+	if (!changeVertex(keptCount, keptCount, massCenter)) globalContraction();
+}
+
+// Lee-Wiswall parallel step: the worstCount worst vertices are reflected against
+// the mass center of the remaining ones, each on its own thread of the pool.
+// The simplex shrinks only when none of them could be improved.
+void nelderMead::changeSimplexParallel(int worstCount)
+{
+	int keptCount = simplex.size() - worstCount;
+	vector<double> massCenter = calculateMassCenter(keptCount);
+	vector<char> improved(worstCount);
+	pool->forEach(worstCount, [&](size_t i) {
+		improved[i] = changeVertex(keptCount + i, keptCount, massCenter);
+	});
+	if (std::find(improved.begin(), improved.end(), true) == improved.end()) globalContraction();
+}
+
+// Speculative step: the reflection, expansion and both contraction points
+// depend only on the mass center and the worst vertex, so all four are
+// evaluated at once on the pool. The usual rules then pick one of them, and
+// an evaluation error counts only if that point is actually used.
+void nelderMead::changeSimplexSpeculative()
+{
+	int keptCount = simplex.size() - 1;
+	element& worst = simplex.back();
+	nelderMeadStep step(params);
+	vector<double> massCenter = calculateMassCenter(keptCount);
+	vector<double> reflectionPoint = trialPoint(massCenter, worst.point, step.reflection);
+	vector<vector<double>> points = {
+		reflectionPoint,
+		trialPoint(massCenter, reflectionPoint, step.expansion),
+		trialPoint(massCenter, reflectionPoint, step.contraction),
+		trialPoint(massCenter, worst.point, step.contraction)
+	};
+	vector<element> trials(points.size());
+	vector<exception_ptr> errors(points.size());
+	pool->forEach(points.size(), [&](size_t i) {
+		try {
+			trials[i] = evaluatePoint(move(points[i]));
+		}
+		catch (...) {
+			errors[i] = current_exception();
+		}
+	});
+	auto trial = [&](int i) -> element& {
+		if (errors[i]) rethrow_exception(errors[i]);
+		return trials[i];
+	};
+
+	element& reflection = trial(0);
+	logPoint(reflectionLabel, reflection.point);
+	nelderMeadStep::outcome outcome = afterReflection(reflection, keptCount);
+	if (outcome == nelderMeadStep::acceptReflection) {
+		worst = reflection;
+	}
+	else if (outcome == nelderMeadStep::tryExpansion) {
+		element& expansion = trial(1);
+		logPoint(expansionLabel, expansion.point);
+		if (nelderMeadStep::isExpansionAccepted(expansion.functionValue, reflection.functionValue)) worst = expansion;
+		else worst = reflection;
 	}
 	else {
-		performContraction(reflection, massCenter);
+		element& contraction = nelderMeadStep::contractsTowardsVertex(worst.functionValue, reflection.functionValue) ? trial(3) : trial(2);
+		logPoint(contractionLabel, contraction.point);
+		if (nelderMeadStep::isContractionAccepted(contraction.functionValue, worst.functionValue, reflection.functionValue)) worst = contraction;
+		else globalContraction();
 	}
 }
 
-void nelderMead::performContraction(element& reflection, std::vector<double>& massCenter)
+bool nelderMead::changeVertex(int vertex, int keptCount, std::vector<double>& massCenter)
 {
-	element contraction = calculateContraction(reflection, massCenter);
-	output->write(": " + printVector(contraction.point, -1));
-	if (contraction.functionValue < min(simplex.back().functionValue, reflection.functionValue))
-		simplex.back() = contraction;
-	else globalContraction();
+	element reflection = evaluatePoint(trialPoint(massCenter, simplex[vertex].point, nelderMeadStep(params).reflection));
+	logPoint(reflectionLabel, reflection.point);
+	nelderMeadStep::outcome outcome = afterReflection(reflection, keptCount);
+	if (outcome == nelderMeadStep::acceptReflection) {
+		simplex[vertex] = reflection;
+	}
+	else if (outcome == nelderMeadStep::tryExpansion) {
+		performExpansion(massCenter, reflection, vertex);
+	}
+	else {
+		return performContraction(reflection, massCenter, vertex);
+	}
+	return true;
 }
 
-void nelderMead::performExpansion(std::vector<double>& massCenter, element& reflection)
+bool nelderMead::performContraction(element& reflection, std::vector<double>& massCenter, int vertex)
 {
-	element expansion = element(massCenter * (1 - params.expansionCoeff) + reflection.point * params.expansionCoeff, function);
-	output->write(": " + printVector(expansion.point, -1));
-	if (expansion.functionValue < reflection.functionValue) simplex.back() = expansion;
-	else simplex.back() = reflection;
+	element contraction = calculateContraction(reflection, massCenter, vertex);
+	logPoint(contractionLabel, contraction.point);
+	if (nelderMeadStep::isContractionAccepted(contraction.functionValue, simplex[vertex].functionValue, reflection.functionValue)) {
+		simplex[vertex] = contraction;
+		return true;
+	}
+	return false;
 }
 
-bool nelderMead::isExpansionNeeded(element& reflection)
+void nelderMead::performExpansion(std::vector<double>& massCenter, element& reflection, int vertex)
 {
-	return reflection.functionValue < simplex.front().functionValue;
+	element expansion = evaluatePoint(trialPoint(massCenter, reflection.point, nelderMeadStep(params).expansion));
+	logPoint(expansionLabel, expansion.point);
+	if (nelderMeadStep::isExpansionAccepted(expansion.functionValue, reflection.functionValue)) simplex[vertex] = expansion;
+	else simplex[vertex] = reflection;
 }
 
-bool nelderMead::isReflectionAcceptable(element& reflection)
+nelderMeadStep::outcome nelderMead::afterReflection(const element& reflection, int keptCount)
 {
-	return simplex.front().functionValue <= reflection.functionValue && reflection.functionValue <= simplex.at(simplex.size() - 2).functionValue;
+	return nelderMeadStep::afterReflection(reflection.functionValue, simplex.front().functionValue, simplex.at(keptCount - 1).functionValue);
 }
 
 void nelderMead::globalContraction()
 {
+	auto contractVertex = [&](size_t i) {
+		simplex[i] = evaluatePoint(trialPoint(simplex[i].point, simplex.front().point, nelderMeadStep::shrink));
+	};
+	if (pool != nullptr) {
+		pool->forEach(simplex.size() - 1, [&](size_t i) { contractVertex(i + 1); });
+		return;
+	}
 	for (int i = 1; i < simplex.size(); i++)
-		simplex[i] = element(simplex[i].point + ((simplex.front().point - simplex[i].point) / 2.0), function);
+		contractVertex(i);
 }
 
 bool nelderMead::endCheck(double eps, vector<element> simplex)
 {
+	return (simplexSpread(simplex) <= eps);
+}
+
+// Root mean square deviation of the vertex values from the best one.
+double nelderMead::simplexSpread(const vector<element>& vertices)
+{
+	const element& best = *min_element(vertices.begin(), vertices.end(),
+		[](const element& a, const element& b) {
+			return a.functionValue < b.functionValue;
+		}
+	);
 	double sum = 0;
-	for (int i = 1; i < simplex.size(); i++)
+	for (int i = 0; i < vertices.size(); i++)
 	{
-		sum += pow(simplex[i].functionValue - simplex.front().functionValue, 2);
+		if (&vertices[i] != &best) sum += pow(vertices[i].functionValue - best.functionValue, 2);
 	}
-	double dist = sqrt(sum / (simplex.size() - 1));
-	return (dist <= eps);
+	return sqrt(sum / (vertices.size() - 1));
 }
 
-element nelderMead::calculateContraction(element reflection, vector<double> massCenter)
+element nelderMead::calculateContraction(element reflection, vector<double> massCenter, int vertex)
 {
-	element contraction;
-	if (simplex.back().functionValue <= reflection.functionValue)
-		contraction = element(massCenter + (simplex.back().point - massCenter) * params.contractionCoeff, function);
-	else contraction = element(massCenter + (reflection.point - massCenter) * params.contractionCoeff, function);
-	return contraction;
+	const vector<double>& towards = nelderMeadStep::contractsTowardsVertex(simplex[vertex].functionValue, reflection.functionValue) ?
+		simplex[vertex].point : reflection.point;
+	return evaluatePoint(trialPoint(massCenter, towards, nelderMeadStep(params).contraction));
 }
 
 void nelderMead::sendPoints()
@@ -139,12 +556,17 @@ void nelderMead::sendPoints()
 }
 
 string nelderMead::printVector(vector<double> point, int number)
+{
+	return printVector(point.data(), point.size(), number);
+}
+
+string nelderMead::printVector(const double* point, int size, int number)
 {
 	string str = "X" + to_string(number) + "=(";
 	if (number == -1) str = "(";
-	for (int i = 0; i < point.size(); ++i) {
+	for (int i = 0; i < size; ++i) {
 		str += to_string(point[i]);
-		if (i < point.size() - 1) str += ", ";
+		if (i < size - 1) str += ", ";
 	}
 	str += ")";
 	return str;
@@ -152,32 +574,99 @@ string nelderMead::printVector(vector<double> point, int number)
 
 void nelderMead::makeStartSimplex(int varsCount, vector<double> startingPoint)
 {
-	simplex.push_back(element(startingPoint, function));
+	if (hasBounds() || !constraints.empty()) {
+		projectToBounds(startingPoint);
+		simplex.push_back(evaluatePoint(startingPoint));
+		for (int i = 0; i < varsCount; i++)
+			simplex.push_back(evaluatePoint(startingVertex(startingPoint, i)));
+		return;
+	}
+	vector<double> values = evaluateCoordinateSteps(startingPoint.data(), varsCount, params.scale);
+	simplex.push_back(element(startingPoint, values[0]));
 	for (int i = 0; i < varsCount; i++) {
 		vector<double> newPoint(startingPoint);
 		newPoint[i] += params.scale;
-		simplex.push_back(element(newPoint, function));
+		simplex.push_back(element(newPoint, values[i + 1]));
 	}
 }
 
-vector<double> nelderMead::calculateMassCenter()
+vector<double> nelderMead::calculateMassCenter(int count)
 {
-	vector<double> massCenter(simplex.size() - 1);
-	for (int i = 0; i < simplex.size() - 1; i++)
-		massCenter = massCenter + simplex[i].point / (double)(simplex.size() - 1);
+	vector<double> massCenter(simplex.front().point.size());
+	for (int i = 0; i < count; i++)
+		massCenter += simplex[i].point / (double)count;
 	return massCenter;
 }
 
 void nelderMead::logSimplex(int k)
 {
-	output->write(" " + to_string(k));
-	output->write(" : ");
 	string data;
 	for (int i = 0; i < simplex.size(); i++)
 	{
 		data += printVector(simplex[i].point, i);
 		if (i < simplex.size() - 1) data += ", ";
 	}
-	output->write(data);
+	logStep(k, data);
 }
 
+void nelderMead::logStep(int k, string vertices)
+{
+	output->write(" " + to_string(k));
+	output->write(" : ");
+	output->write(vertices);
+}
+
+void nelderMead::logPoint(string label, vector<double>& point)
+{
+	logPoint(label, point.data(), point.size());
+}
+
+void nelderMead::logPoint(string label, const double* point, int size)
+{
+	lock_guard<mutex> lock(outputMutex);
+	output->write(label + printVector(point, size, -1));
+}
+
+
+multidirectionalSearch::multidirectionalSearch(pointsCallback callback, char* function, nelderMeadParams params):
+	nelderMead(callback, function, params) {}
+
+bool multidirectionalSearch::canRunFixed(int)
+{
+	return false;
+}
+
+void multidirectionalSearch::changeSimplex()
+{
+	vector<element> reflection = transformSimplex(-params.reflectionCoeff, reflectionLabel);
+	if (minValue(reflection) < simplex.front().functionValue) {
+		vector<element> expansion = transformSimplex(-params.expansionCoeff, expansionLabel);
+		if (minValue(expansion) < minValue(reflection)) reflection = expansion;
+		std::copy(reflection.begin(), reflection.end(), simplex.begin() + 1);
+	}
+	else {
+		vector<element> contraction = transformSimplex(params.contractionCoeff, contractionLabel);
+		std::copy(contraction.begin(), contraction.end(), simplex.begin() + 1);
+	}
+}
+
+// Maps every vertex except the best one to best + (vertex - best) * coeff;
+// the new vertices are evaluated concurrently.
+vector<element> multidirectionalSearch::transformSimplex(double coeff, string label)
+{
+	vector<element> vertices(simplex.size() - 1);
+	pool->forEach(vertices.size(), [&](size_t i) {
+		vertices[i] = evaluatePoint(trialPoint(simplex.front().point, simplex[i + 1].point, coeff));
+		logPoint(label, vertices[i].point);
+	});
+	return vertices;
+}
+
+double multidirectionalSearch::minValue(vector<element>& vertices)
+{
+	return std::min_element(vertices.begin(), vertices.end(),
+		[](const element& a, const element& b) {
+			return a.functionValue < b.functionValue;
+		}
+	)->functionValue;
+}
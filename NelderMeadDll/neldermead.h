@@ -6,14 +6,23 @@
 #define MYDLL_API __declspec(dllimport)
 #endif
 
+#include <algorithm>
 #include <vector>
 #include <fstream>
+#include <memory>
+#include <mutex>
 #include "writer.h"
+#include "threadPool.h"
+#include "errors.h"
+#include "nativeExpression.h"
 
 using namespace std;
 
 typedef void (*pointsCallback)(double* point);
 
+class compiledExpression;
+struct checkpoint;
+
 struct nelderMeadParams {
 	double reflectionCoeff;
 	double contractionCoeff;
@@ -22,19 +31,96 @@ struct nelderMeadParams {
 	double eps;
 	int maxSteps;
 	string outputType;
+	int parallelVertices = 1;
+	int threads = 0;
+	string method = "nelderMead";
+	bool speculative = false;
+	bool polish = false;
+	// the polish stops once the gradient norm falls below it
+	double polishTolerance = 1e-8;
+	bool nativeCode = false;
+	unsigned long long randomSeed = 0;
+	bool singlePrecision = false;
+	// Per-variable box; variables past the end of a vector are unbounded.
+	vector<double> lowerBounds;
+	vector<double> upperBounds;
+	// Cheap conditions such as "x1 + x2 <= 1", checked before the function;
+	// a point is infeasible when one of them is zero or cannot be evaluated.
+	vector<string> constraints;
+	// Every checkpointInterval steps the solver state is saved to
+	// checkpointFile for resumeFunctionMinimum. There is no default file, so
+	// that concurrent solvers do not overwrite each other's checkpoints;
+	// checkpoints are written only when both are set.
+	int checkpointInterval = 0;
+	string checkpointFile;
+};
+
+// The classic Nelder-Mead step, apart from how points are stored and
+// evaluated: the coefficients of the trial points c + t * (p - c) around the
+// mass center c, and the rules that pick between them. nelderMead,
+// askTellNelderMead and fixedNelderMead all step through it.
+struct nelderMeadStep {
+	enum outcome { acceptReflection, tryExpansion, tryContraction };
+
+	double reflection;
+	double expansion;
+	double contraction;
+	static constexpr double shrink = 0.5;
+
+	nelderMeadStep(const nelderMeadParams& params):
+		reflection(-params.reflectionCoeff),
+		expansion(params.expansionCoeff),
+		contraction(params.contractionCoeff) {}
+
+	// best and worstKept are the extreme values of the vertices that stay.
+	static outcome afterReflection(double reflected, double best, double worstKept) {
+		if (best <= reflected && reflected <= worstKept) return acceptReflection;
+		return reflected < best ? tryExpansion : tryContraction;
+	}
+	static bool isExpansionAccepted(double expanded, double reflected) {
+		return expanded < reflected;
+	}
+	// The contraction goes towards the better of the vertex and its reflection.
+	static bool contractsTowardsVertex(double vertex, double reflected) {
+		return vertex <= reflected;
+	}
+	static bool isContractionAccepted(double contracted, double vertex, double reflected) {
+		return contracted < min(vertex, reflected);
+	}
 };
 
 extern "C" MYDLL_API double evaluateFunction(double* pointPtr, int size, char* function);
 extern "C" MYDLL_API double* findFunctionMinimum(pointsCallback callback, int varsCount, double* startingPointPtr, char* function);
+extern "C" MYDLL_API double* findFunctionMinimumBatch(int problemsCount, int varsCount, double* startingPointsPtr, char* function);
+// Parameter sweep: the expression may use p1..pM besides x1..xN, and
+// parametersPtr holds one row of parametersCount values per problem. The
+// expression is parsed once for all problems.
+extern "C" MYDLL_API double* findFunctionMinimumSweep(int problemsCount, int varsCount, double* startingPointsPtr, int parametersCount, double* parametersPtr, char* function);
+// evaluateFunction for an expression with parameters p1..pM; rebinding them
+// to other values does not compile the expression again.
+extern "C" MYDLL_API double evaluateFunctionWithParameters(double* pointPtr, int size, double* parametersPtr, int parametersCount, char* function);
+// Warm start: simplexPtr holds varsCount + 1 vertices of varsCount values
+// each and valuesPtr, unless it is null, their function values, which are
+// then not evaluated again. On return both hold the final simplex, ready to
+// start the next, slightly changed problem; its first vertex is the returned
+// point.
+extern "C" MYDLL_API double* findFunctionMinimumFromSimplex(pointsCallback callback, int varsCount, double* simplexPtr, double* valuesPtr, char* function);
+// Continues the run saved in a checkpoint with the function and params stored
+// there; the simplex is not evaluated again.
+extern "C" MYDLL_API double* resumeFunctionMinimum(pointsCallback callback, char* checkpointPath);
+// Error of the last exported call made on the calling thread; the exported
+// functions return nullptr, NaN or a negative count when they fail.
+extern "C" MYDLL_API int getLastErrorCode();
+extern "C" MYDLL_API const char* getLastErrorMessage();
 
 class element {
 public:
 	vector<double> point;
 	double functionValue;
 	element() : point({ 0, 0 }), functionValue(0) {}
-	element(vector<double> p, char* function):
-		point(p),
-		functionValue(evaluateFunction(p.data(), p.size(), function)) {}
+	element(vector<double> p, double functionValue):
+		point(move(p)),
+		functionValue(functionValue) {}
 };
 
 class nelderMead {
@@ -42,23 +128,79 @@ public:
 	nelderMeadParams params;
 	vector<element> simplex;
 	writer* output;
+	threadPool* pool;
+	mutex outputMutex;
 	pointsCallback callback;
 	char* function;
-	nelderMead(pointsCallback callback, char* function);
+	vector<shared_ptr<compiledExpression>> constraints;
+	// resolved by prepare(); the evaluators call through them
+	shared_ptr<compiledExpression> expression;
+	nativeFunction native = nullptr;
+	static const string reflectionLabel;
+	static const string expansionLabel;
+	static const string contractionLabel;
+	static const string bestLabel;
+	// usePool is false for engines that never evaluate points themselves.
+	nelderMead(pointsCallback callback, char* function, bool usePool = true);
+	nelderMead(pointsCallback callback, char* function, nelderMeadParams params, bool usePool = true);
+	virtual ~nelderMead();
 	writer* chooseOutput();
+	threadPool* choosePool();
 	vector<double> start(int varsCount, double* startingPointPtr);
+	vector<double> startFromSimplex(int varsCount, const double* simplexPtr, const double* valuesPtr);
+	vector<double> resume(const checkpoint& state);
+	void prepare(int varsCount);
+	vector<double> finish(vector<double> result);
+	void checkBounds(int varsCount);
+	bool hasBounds();
+	bool hasCheckpoints();
+	void projectToBounds(vector<double>& point);
+	vector<double> trialPoint(const vector<double>& c, const vector<double>& p, double t);
+	vector<double> startingVertex(const vector<double>& startingPoint, int i);
+	void prepareConstraints(int varsCount);
+	bool isFeasible(const vector<double>& point);
+	// The function as the optimizer sees it: never throws, points where it is
+	// undefined or not finite get +inf so that vertices stay comparable.
+	double evaluateObjective(const double* point);
+	vector<double> evaluateCoordinateSteps(const double* point, int size, double step);
+	element evaluatePoint(vector<double> point);
+	virtual bool canRunFixed(int varsCount);
+	vector<double> run(int varsCount, double* startingPointPtr);
+	vector<double> iterate(int firstStep);
+	checkpoint makeCheckpoint(int step);
 	void sendPoints();
 	string printVector(vector<double> point, int number);
+	string printVector(const double* point, int size, int number);
 	void makeStartSimplex(int varsCount, vector<double> startingPoint);
-	vector<double> calculateMassCenter();
-	void changeSimplex();
-	void performContraction(element& reflection, std::vector<double>& massCenter);
-	void performExpansion(std::vector<double>& massCenter, element& reflection);
-	bool isExpansionNeeded(element& reflection);
-	bool isReflectionAcceptable(element& reflection);
+	vector<double> calculateMassCenter(int count);
+	virtual void changeSimplex();
+	void changeSimplexParallel(int worstCount);
+	void changeSimplexSpeculative();
+	bool changeVertex(int vertex, int keptCount, std::vector<double>& massCenter);
+	bool performContraction(element& reflection, std::vector<double>& massCenter, int vertex);
+	void performExpansion(std::vector<double>& massCenter, element& reflection, int vertex);
+	nelderMeadStep::outcome afterReflection(const element& reflection, int keptCount);
 	void globalContraction();
 	bool endCheck(double eps, vector<element> simplex);
-	element calculateContraction(element reflection, vector<double> massCenter);
+	double simplexSpread(const vector<element>& vertices);
+	element calculateContraction(element reflection, vector<double> massCenter, int vertex);
 	void logSimplex(int k);
+	void logStep(int k, string vertices);
+	void logPoint(string label, vector<double>& point);
+	void logPoint(string label, const double* point, int size);
 };
 
+// Torczon's multidirectional search: every step reflects, expands or contracts
+// all edges of the simplex around the best vertex at once.
+class multidirectionalSearch : public nelderMead {
+public:
+	multidirectionalSearch(pointsCallback callback, char* function, nelderMeadParams params);
+	bool canRunFixed(int) override;
+	void changeSimplex() override;
+	vector<element> transformSimplex(double coeff, string label);
+	double minValue(vector<element>& vertices);
+};
+
+nelderMead* chooseMethod(pointsCallback callback, char* function);
+nelderMead* chooseMethod(pointsCallback callback, char* function, nelderMeadParams params);
+
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+
+using namespace std;
+
+class threadPool {
+private:
+	vector<thread> workers;
+	mutex tasksMutex;
+	condition_variable tasksReady;
+	condition_variable tasksDone;
+	function<void(size_t)> task;
+	size_t tasksCount = 0;
+	size_t nextTask = 0;
+	size_t finishedTasks = 0;
+	size_t generation = 0;
+	bool stopping = false;
+	exception_ptr error;
+
+	void runTasks(unique_lock<mutex>& lock) {
+		while (nextTask < tasksCount) {
+			size_t index = nextTask++;
+			lock.unlock();
+			exception_ptr taskError;
+			try {
+				task(index);
+			}
+			catch (...) {
+				taskError = current_exception();
+			}
+			lock.lock();
+			if (taskError && !error) error = taskError;
+			if (++finishedTasks == tasksCount) tasksDone.notify_all();
+		}
+	}
+
+	void workerLoop() {
+		unique_lock<mutex> lock(tasksMutex);
+		size_t seenGeneration = generation;
+		while (true) {
+			tasksReady.wait(lock, [&] { return stopping || generation != seenGeneration; });
+			if (stopping) return;
+			seenGeneration = generation;
+			runTasks(lock);
+		}
+	}
+
+public:
+	threadPool(size_t threadsCount) {
+		if (threadsCount == 0) threadsCount = max<size_t>(1, thread::hardware_concurrency());
+		// the calling thread takes part in forEach, so it is not counted as a worker
+		for (size_t i = 1; i < threadsCount; i++)
+			workers.emplace_back(&threadPool::workerLoop, this);
+	}
+	~threadPool() {
+		{
+			lock_guard<mutex> lock(tasksMutex);
+			stopping = true;
+		}
+		tasksReady.notify_all();
+		for (thread& worker : workers) worker.join();
+	}
+	size_t size() {
+		return workers.size() + 1;
+	}
+	// Calls body(0) .. body(count - 1) concurrently and waits for all of them.
+	// The first exception thrown by any call is rethrown here.
+	void forEach(size_t count, function<void(size_t)> body) {
+		if (count == 0) return;
+		unique_lock<mutex> lock(tasksMutex);
+		task = move(body);
+		tasksCount = count;
+		nextTask = 0;
+		finishedTasks = 0;
+		error = nullptr;
+		generation++;
+		tasksReady.notify_all();
+		runTasks(lock);
+		tasksDone.wait(lock, [&] { return finishedTasks == tasksCount; });
+		task = nullptr;
+		if (error) rethrow_exception(error);
+	}
+};
@@ -48,6 +48,7 @@
  */
 #include "pch.h"
 #include "tinyexpr.h"
+#include <ranges>
 
 // builtin functions
 namespace te_builtins
@@ -474,20 +475,78 @@ namespace te_builtins
         return std::tgamma(val);
         }
 
+    /// @brief xoshiro256** by Blackman and Vigna. Its state is four words, so every
+    ///     thread keeps its own generator instead of sharing a locked one.
+    class te_random_engine
+        {
+      public:
+        te_random_engine() = default;
+
+        explicit te_random_engine(const uint64_t value) noexcept { seed(value); }
+
+        void seed(uint64_t value) noexcept
+            {
+            // splitmix64 spreads the seed over the whole state
+            for (auto& word : m_state)
+                {
+                value += 0x9E3779B97F4A7C15ULL;
+                uint64_t mixed{ value };
+                mixed = (mixed ^ (mixed >> 30)) * 0xBF58476D1CE4E5B9ULL;
+                mixed = (mixed ^ (mixed >> 27)) * 0x94D049BB133111EBULL;
+                word = mixed ^ (mixed >> 31);
+                }
+            }
+
+        uint64_t next() noexcept
+            {
+            const uint64_t result = rotl(m_state[1] * 5, 7) * 9;
+            const uint64_t shifted = m_state[1] << 17;
+            m_state[2] ^= m_state[0];
+            m_state[3] ^= m_state[1];
+            m_state[1] ^= m_state[2];
+            m_state[0] ^= m_state[3];
+            m_state[2] ^= shifted;
+            m_state[3] = rotl(m_state[3], 45);
+            return result;
+            }
+
+      private:
+        constexpr static uint64_t rotl(const uint64_t value, const int shift) noexcept
+            {
+            return (value << shift) | (value >> (64 - shift));
+            }
+
+        std::array<uint64_t, 4> m_state{};
+        };
+
     [[nodiscard]]
-    static te_type te_random()
+    static uint64_t te_default_random_seed()
         {
 #ifdef TE_RAND_SEED
-        std::mt19937 gen(static_cast<unsigned int>(RAND_SEED));
+        return static_cast<uint64_t>(RAND_SEED);
 #elif defined(TE_RAND_SEED_TIME)
-        std::mt19937 gen(static_cast<unsigned int>(time(nullptr)));
+        return static_cast<uint64_t>(time(nullptr));
 #else
-        static std::random_device rdev;
-        std::mt19937 gen(rdev());
+        std::random_device rdev;
+        return (static_cast<uint64_t>(rdev()) << 32) ^ rdev();
 #endif
+        }
+
+    /// @returns The generator of the calling thread. Nothing is shared between
+    ///     threads, so concurrent sessions cannot disturb each other.
+    [[nodiscard]]
+    static te_random_engine& te_thread_random_engine()
+        {
+        thread_local te_random_engine engine{ te_default_random_seed() };
+        return engine;
+        }
 
-        std::uniform_real_distribution<te_type> distr(0, 1);
-        return distr(gen);
+    [[nodiscard]]
+    static te_type te_random()
+        {
+        // the top 53 bits give a uniform double in [0, 1)
+        return static_cast<te_type>(
+            static_cast<double>(te_thread_random_engine().next() >> 11) * 0x1.0p-53);
         }
 
     [[nodiscard]]
@@ -1115,6 +1174,50 @@ namespace te_builtins
         return val * val;
         }
 
+    /// @brief Raises @c val to a small positive integer power by repeated squaring.
+    template<unsigned Exponent>
+    [[nodiscard]]
+    constexpr static te_type te_ipow(te_type val) noexcept
+        {
+        if constexpr (Exponent == 1)
+            {
+            return val;
+            }
+        else
+            {
+            const te_type half = te_ipow<Exponent / 2>(val);
+            if constexpr (Exponent % 2 == 0)
+                {
+                return half * half;
+                }
+            else
+                {
+                return half * half * val;
+                }
+            }
+        }
+
+    // te_ipow specializations that pow() with a constant exponent is rewritten to,
+    // indexed by exponent (squares become te_sqr)
+    constexpr te_fun1 te_ipow_functions[] = { nullptr, nullptr, te_sqr, te_ipow<3>,
+                                              te_ipow<4>, te_ipow<5>, te_ipow<6>, te_ipow<7>,
+                                              te_ipow<8> };
+
+    /// @returns The exponent that @c func raises its argument to, or 0 if it
+    ///     is not one of the te_ipow_functions.
+    [[nodiscard]]
+    static unsigned te_ipow_exponent(const te_fun1 func) noexcept
+        {
+        for (unsigned exponent = 2; exponent < std::size(te_ipow_functions); ++exponent)
+            {
+            if (te_ipow_functions[exponent] == func)
+                {
+                return exponent;
+                }
+            }
+        return 0;
+        }
+
     [[nodiscard]]
     static te_type te_max_maybe_nan(te_type val1, te_type val2MaybeNan) noexcept
         {
@@ -1368,30 +1471,75 @@ namespace te_builtins
     } // namespace te_builtins
 
 //--------------------------------------------------
-void te_parser::te_free_parameters(te_expr* texp)
+void te_parser::set_random_stream(const uint64_t seed, const uint64_t stream)
     {
-    if (texp == nullptr)
-        {
-        return;
-        }
-    if (is_closure(texp->m_value))
+    te_builtins::te_thread_random_engine().seed(seed + 0xD1B54A32D192ED03ULL * stream);
+    }
+
+//--------------------------------------------------
+void te_expr_arena::add_block(const size_t size)
+    {
+    m_blocks.push_back({ std::make_unique<std::byte[]>(size), size });
+    m_used = 0;
+    }
+
+//--------------------------------------------------
+void te_expr_arena::reserve(const size_t size)
+    {
+    if (m_blocks.empty() || m_blocks.back().m_size - m_used < size)
         {
-        // last param is the context object, we don't manage that here
-        for (auto param = texp->m_parameters.begin(); param != texp->m_parameters.end() - 1;
-             ++param)
+        // an unused block is replaced rather than kept around
+        if (!m_blocks.empty() && m_used == 0)
             {
-            te_free(*param);
-            *param = nullptr;
+            m_blocks.pop_back();
             }
+        add_block(size);
+        }
+    }
+
+//--------------------------------------------------
+void* te_expr_arena::allocate(size_t size)
+    {
+    constexpr size_t alignment = alignof(std::max_align_t);
+    size = (size + alignment - 1) & ~(alignment - 1);
+    if (m_blocks.empty() || m_blocks.back().m_size - m_used < size)
+        {
+        // blocks double, so a growing expression needs few of them
+        add_block(std::max<size_t>({ size, 4096, m_blocks.empty() ? 0 : 2 * m_blocks.back().m_size }));
         }
-    else if (is_function(texp->m_value))
+    void* memory = m_blocks.back().m_data.get() + m_used;
+    m_used += size;
+    return memory;
+    }
+
+//--------------------------------------------------
+void te_expr_arena::reset() noexcept
+    {
+    if (m_blocks.empty())
         {
-        for (auto* param : texp->m_parameters)
-            {
-            te_free(param);
-            param = nullptr;
-            }
+        return;
         }
+    // the nodes are trivially destructible, so only the memory goes; the
+    // largest block stays for the next expression
+    auto largest = std::max_element(m_blocks.begin(), m_blocks.end(),
+                                    [](const block& lhv, const block& rhv) noexcept
+                                    { return lhv.m_size < rhv.m_size; });
+    std::swap(*largest, m_blocks.front());
+    m_blocks.resize(1);
+    m_used = 0;
+    }
+
+//--------------------------------------------------
+te_expr* te_parser::allocate_expr(const te_variable_flags type, te_variant_type value,
+                                  const size_t parameterCount)
+    {
+    std::byte* memory = static_cast<std::byte*>(
+        m_arena.allocate(sizeof(te_expr) + parameterCount * sizeof(te_expr*)));
+    te_expr* ret = new (memory) te_expr{ type, std::move(value) };
+    auto** parameters = reinterpret_cast<te_expr**>(memory + sizeof(te_expr));
+    std::uninitialized_fill_n(parameters, parameterCount, nullptr);
+    ret->m_parameters = te_expr_parameters{ parameters, parameterCount };
+    return ret;
     }
 
 //--------------------------------------------------
@@ -1478,7 +1626,7 @@ const std::set<te_variable> te_parser::m_functions = { // NOLINT
     { "pi", static_cast<te_fun0>(te_builtins::te_pi), TE_PURE },
     { "pow", static_cast<te_fun2>(te_builtins::te_pow), TE_PURE },
     { "power", /* Excel alias*/ static_cast<te_fun2>(te_builtins::te_pow), TE_PURE },
-    { "rand", static_cast<te_fun0>(te_builtins::te_random), TE_PURE },
+    { "rand", static_cast<te_fun0>(te_builtins::te_random), static_cast<te_variable_flags>(0) },
     { "round", static_cast<te_fun2>(te_builtins::te_round),
       static_cast<te_variable_flags>(TE_PURE | TE_VARIADIC) },
     { "sign", static_cast<te_fun1>(te_builtins::te_sign), TE_PURE },
@@ -1497,6 +1645,65 @@ const std::set<te_variable> te_parser::m_functions = { // NOLINT
     { "trunc", static_cast<te_fun1>(te_builtins::te_trunc), TE_PURE }
 };
 
+//--------------------------------------------------
+std::set<te_variable>::const_iterator te_parser::find_builtin(const std::string_view name)
+    {
+    // FNV-1a over the lowercased name; the seed is chosen once so that
+    // no two built-ins share a slot, making the table a perfect hash
+    const auto hash = [](const std::string_view str, const uint32_t seed) noexcept
+    {
+        uint32_t result{ 2166136261U ^ seed };
+        for (const char ch : str)
+            {
+            result ^= static_cast<uint32_t>(te_string_less::tolower(ch));
+            result *= 16777619U;
+            }
+        return result;
+    };
+
+    struct builtin_table
+        {
+        uint32_t m_seed{ 0 };
+        std::vector<std::set<te_variable>::const_iterator> m_slots;
+        };
+
+    static const builtin_table table = [&hash]()
+    {
+        builtin_table newTable;
+        size_t size{ 1 };
+        while (size < m_functions.size() * 4)
+            {
+            size *= 2;
+            }
+        bool collision{ true };
+        while (collision)
+            {
+            ++newTable.m_seed;
+            newTable.m_slots.assign(size, m_functions.cend());
+            collision = false;
+            for (auto func = m_functions.cbegin(); func != m_functions.cend() && !collision; ++func)
+                {
+                auto& slot = newTable.m_slots[hash(func->m_name, newTable.m_seed) & (size - 1)];
+                collision = (slot != m_functions.cend());
+                slot = func;
+                }
+            }
+        return newTable;
+    }();
+
+    const auto candidate = table.m_slots[hash(name, table.m_seed) & (table.m_slots.size() - 1)];
+    if (candidate == m_functions.cend() || candidate->m_name.length() != name.length() ||
+        !std::equal(name.cbegin(), name.cend(), candidate->m_name.cbegin(),
+                    [](const char lhs, const char rhs) noexcept
+                    {
+                        return te_string_less::tolower(lhs) == te_string_less::tolower(rhs);
+                    }))
+        {
+        return m_functions.cend();
+        }
+    return candidate;
+    }
+
 //--------------------------------------------------
 void te_parser::next_token(te_parser::state* theState)
     {
@@ -1545,6 +1752,16 @@ void te_parser::next_token(te_parser::state* theState)
                 m_varFound = false;
                 const std::string_view currentVarToken{ start, static_cast<std::string::size_type>(
                                                                    theState->m_next - start) };
+                const te_type* indexedVar = find_indexed_variable(currentVarToken);
+                if (indexedVar != nullptr)
+                    {
+#ifndef TE_NO_BOOKKEEPING
+                    m_usedVars.insert(te_variable::name_type{ currentVarToken });
+#endif
+                    theState->m_type = te_parser::state::token_type::TOK_VARIABLE;
+                    theState->m_value = indexedVar;
+                    continue;
+                    }
                 m_currentVar = find_lookup(theState, currentVarToken);
                 if (m_currentVar != theState->m_lookup.cend())
                     {
@@ -2242,9 +2459,7 @@ te_expr* te_parser::factor(te_parser::state* theState)
     if (ret->m_type == TE_PURE && is_function1(ret->m_value) &&
         get_function1(ret->m_value) == te_builtins::te_negate)
         {
-        te_expr* se = ret->m_parameters[0];
-        delete ret;
-        ret = se;
+        ret = ret->m_parameters[0];
         neg = 1;
         }
 
@@ -2359,6 +2574,46 @@ auto make_function_arg_list(const F& fn, std::index_sequence<Indices...>)
     return std::make_tuple(fn(Indices)...);
     }
 
+// Calls the function held by value with its arguments taken from M(0), M(1), ...
+// context is passed to closures.
+template<typename F>
+te_type te_apply_function(const te_variant_type& value, te_expr* context, const F& M)
+    {
+    // NOLINTBEGIN
+    return std::visit(
+        [&, context](const auto& var) -> te_type
+        {
+            using T = std::decay_t<decltype(var)>;
+            if constexpr (std::is_same_v<T, te_fun0>)
+                {
+                return var();
+                }
+            else if constexpr (std::is_same_v<T, te_confun0>)
+                {
+                return var(context);
+                }
+            else if constexpr (te_is_closure_v<T>)
+                {
+                constexpr size_t n_args = te_function_arity<T>;
+                static_assert(n_args > 0);
+                return std::apply(var, make_closure_arg_list(M, context,
+                                                             std::make_index_sequence<n_args - 1>{}));
+                }
+            else if constexpr (te_is_function_v<T>)
+                {
+                constexpr size_t n_args = te_function_arity<T>;
+                return std::apply(var,
+                                  make_function_arg_list(M, std::make_index_sequence<n_args>{}));
+                }
+            else
+                {
+                return te_parser::te_nan;
+                }
+        },
+        value);
+    // NOLINTEND
+    }
+
 te_type te_parser::te_eval(const te_expr* texp)
     {
     if (texp == nullptr)
@@ -2415,134 +2670,1134 @@ te_type te_parser::te_eval(const te_expr* texp)
     }
 
 //--------------------------------------------------
-void te_parser::optimize(te_expr* texp)
+template<typename L>
+void te_parser::te_eval_batch(const te_expr* texp, const size_t lanes, L* results)
     {
+    constexpr L nan = std::numeric_limits<L>::quiet_NaN();
     if (texp == nullptr)
         {
+        std::fill_n(results, lanes, nan);
         return;
         }
-    /* Evaluates as much as possible. */
-    if (is_constant(texp->m_value) || is_variable(texp->m_value))
+    if (is_constant(texp->m_value))
+        {
+        std::fill_n(results, lanes, static_cast<L>(get_constant(texp->m_value)));
+        return;
+        }
+    if (is_variable(texp->m_value))
         {
+        const auto slot = get_shared_index(get_variable(texp->m_value));
+        if (slot != te_parser::npos)
+            {
+            std::copy_n(&get_shared_lanes<L>()[static_cast<size_t>(slot) * lanes], lanes, results);
+            }
+        else
+            {
+            // bound variables are always te_type; the float path rounds them here
+            const te_type* values = get_variable(texp->m_value);
+            for (size_t i = 0; i < lanes; ++i)
+                {
+                results[i] = static_cast<L>(values[i]);
+                }
+            }
         return;
         }
 
-    /* Only optimize out functions flagged as pure. */
-    if (is_pure(texp->m_type))
+    // arguments are evaluated for all lanes first, argument e of lane i is args[e * lanes + i]
+    const auto arity = get_arity(texp->m_value);
+    std::vector<L> args(arity * lanes);
+    for (size_t e = 0; e < arity; ++e)
         {
-        const auto arity = get_arity(texp->m_value);
-        bool known{ true };
-        for (int i = 0; i < arity; ++i)
+        te_eval_batch((e < texp->m_parameters.size()) ? texp->m_parameters[e] : nullptr, lanes,
+                      &args[e * lanes]);
+        }
+    const L* arg0 = args.data();
+    const L* arg1 = args.data() + lanes;
+
+    // tight loops for the arithmetic operators, which the compiler can vectorize
+    if (is_function2(texp->m_value))
+        {
+        const auto func = get_function2(texp->m_value);
+        if (func == te_builtins::te_add)
             {
-            if (texp->m_parameters[i] == nullptr)
+            for (size_t i = 0; i < lanes; ++i)
                 {
-                break;
+                results[i] = arg0[i] + arg1[i];
                 }
-            optimize(texp->m_parameters[i]);
-            if (!is_constant(texp->m_parameters[i]->m_value))
+            return;
+            }
+        if (func == te_builtins::te_sub)
+            {
+            for (size_t i = 0; i < lanes; ++i)
                 {
-                known = false;
+                results[i] = arg0[i] - arg1[i];
                 }
+            return;
             }
-        if (known)
+        if (func == te_builtins::te_mul)
             {
-            const auto value = te_eval(texp);
-            te_free_parameters(texp);
-            texp->m_type = TE_DEFAULT;
-            texp->m_value = value;
+            for (size_t i = 0; i < lanes; ++i)
+                {
+                results[i] = arg0[i] * arg1[i];
+                }
+            return;
             }
-        }
-    }
-
-//--------------------------------------------------
-te_expr* te_parser::te_compile(const std::string_view expression, std::set<te_variable>& variables)
-    {
-    state theState(expression.data(), TE_DEFAULT, variables);
-
-    next_token(&theState);
-    te_expr* root = list(&theState);
-
-    if (theState.m_type != te_parser::state::token_type::TOK_END)
-        {
-        te_free(root);
-        m_errorPos = (theState.m_next - theState.m_start);
-        if (m_errorPos > 0)
+        if (func == te_builtins::te_divide)
             {
-            --m_errorPos;
+            for (size_t i = 0; i < lanes; ++i)
+                {
+                results[i] = (arg1[i] == 0) ? nan : arg0[i] / arg1[i];
+                }
+            return;
             }
-        return nullptr;
-        }
-
-    optimize(root);
-    m_errorPos = te_parser::npos;
-    return root;
-    }
-
-//--------------------------------------------------
-bool te_parser::compile(const std::string_view expression)
-    {
-    reset_state();
-    if (get_list_separator() == get_decimal_separator())
-        {
-        throw std::runtime_error("List and decimal separators cannot be the same");
-        }
-    if (expression.empty())
-        {
-        m_expression.clear();
-        m_errorPos = 0;
-        return false;
-        }
-    m_expression.assign(expression);
-
-    // In case the expression was a spreadsheet formula like "=SUM(...)",
-    // remove the '=' in front.
-    if ((m_expression.length() > 0) && m_expression.front() == '=')
-        {
-        m_expression.erase(0, 1);
         }
-
-    size_t commentStart{ 0 };
-    while (commentStart != std::string::npos)
+    else if (is_function1(texp->m_value))
         {
-        commentStart = m_expression.find('/', commentStart);
-        if (commentStart == std::string::npos || commentStart == m_expression.length() - 1)
+        const auto func = get_function1(texp->m_value);
+        if (func == te_builtins::te_negate)
             {
-            break;
+            for (size_t i = 0; i < lanes; ++i)
+                {
+                results[i] = -arg0[i];
+                }
+            return;
             }
-        // remove multi-line comments
-        if (m_expression[commentStart + 1] == '*')
+        if (func == te_builtins::te_sqr)
             {
-            auto commentEnd = m_expression.find("*/", commentStart);
-            if (commentEnd == std::string::npos)
+            for (size_t i = 0; i < lanes; ++i)
                 {
-                m_errorPos = static_cast<decltype(m_errorPos)>(commentStart);
-                m_parseSuccess = false;
-                m_result = te_nan;
-                return false;
+                results[i] = arg0[i] * arg0[i];
                 }
-            m_expression.erase(commentStart, (commentEnd + 2) - commentStart);
+            return;
             }
-        // remove single-line comments
-        else if (m_expression[commentStart + 1] == '/')
+        if (const auto exponent = te_builtins::te_ipow_exponent(func); exponent != 0)
             {
-            auto commentEnd = m_expression.find_first_of("\n\r", commentStart);
-            if (commentEnd == std::string::npos)
+            // the same squaring chain as te_ipow
+            const auto power = [](const auto& self, const L val, const unsigned n) -> L
+            {
+                if (n == 1)
+                    {
+                    return val;
+                    }
+                const L half = self(self, val, n / 2);
+                return (n % 2 == 0) ? half * half : half * half * val;
+            };
+            for (size_t i = 0; i < lanes; ++i)
                 {
-                m_expression.erase(commentStart);
-                break;
+                results[i] = power(power, arg0[i], exponent);
                 }
-            m_expression.erase(commentStart, commentEnd - commentStart);
+            return;
             }
-        else
+        // the common library functions, called in the lanes' own precision
+        const auto apply = [&](L (*call)(L))
+        {
+            for (size_t i = 0; i < lanes; ++i)
+                {
+                results[i] = call(arg0[i]);
+                }
+        };
+        if (func == te_builtins::te_sqrt)
             {
-            ++commentStart;
+            apply([](const L val)
+                  { return (val < 0) ? std::numeric_limits<L>::quiet_NaN() : std::sqrt(val); });
+            return;
             }
-        }
-
-    try
+        if (func == te_builtins::te_absolute_value)
+            {
+            apply([](const L val) { return std::fabs(val); });
+            return;
+            }
+        if (func == te_builtins::te_exp)
+            {
+            apply([](const L val) { return std::exp(val); });
+            return;
+            }
+        if (func == te_builtins::te_log)
+            {
+            apply([](const L val) { return std::log(val); });
+            return;
+            }
+        if (func == te_builtins::te_sin)
+            {
+            apply([](const L val) { return std::sin(val); });
+            return;
+            }
+        if (func == te_builtins::te_cos)
+            {
+            apply([](const L val) { return std::cos(val); });
+            return;
+            }
+        }
+
+    // NOLINTBEGIN
+    std::visit(
+        [&, texp](const auto& var)
+        {
+            using T = std::decay_t<decltype(var)>;
+            for (size_t i = 0; i < lanes; ++i)
+                {
+                const auto A = [&args, lanes, i](const size_t e)
+                { return static_cast<te_type>(args[e * lanes + i]); };
+                try
+                    {
+                    if constexpr (std::is_same_v<T, te_fun0>)
+                        {
+                        results[i] = static_cast<L>(var());
+                        }
+                    else if constexpr (std::is_same_v<T, te_confun0>)
+                        {
+                        results[i] = static_cast<L>(var(texp->m_parameters[0]));
+                        }
+                    else if constexpr (te_is_closure_v<T>)
+                        {
+                        constexpr size_t n_args = te_function_arity<T>;
+                        results[i] = static_cast<L>(std::apply(
+                            var, make_closure_arg_list(A, texp->m_parameters[n_args - 1],
+                                                       std::make_index_sequence<n_args - 1>{})));
+                        }
+                    else if constexpr (te_is_function_v<T>)
+                        {
+                        constexpr size_t n_args = te_function_arity<T>;
+                        results[i] = static_cast<L>(std::apply(
+                            var, make_function_arg_list(A, std::make_index_sequence<n_args>{})));
+                        }
+                    else
+                        {
+                        results[i] = nan;
+                        }
+                    }
+                catch (const std::exception&)
+                    {
+                    results[i] = nan;
+                    }
+                }
+        },
+        texp->m_value);
+    // NOLINTEND
+    }
+
+//--------------------------------------------------
+te_type te_parser::te_eval_gradient(const te_expr* texp,
+                                    const std::vector<const te_type*>& variables,
+                                    te_type* gradient)
+    {
+    const size_t count = variables.size();
+    if (texp == nullptr)
+        {
+        std::fill_n(gradient, count, te_nan);
+        return te_nan;
+        }
+    if (is_constant(texp->m_value))
+        {
+        std::fill_n(gradient, count, 0);
+        return get_constant(texp->m_value);
+        }
+    if (is_variable(texp->m_value))
+        {
+        const te_type* var = get_variable(texp->m_value);
+        const auto slot = get_shared_index(var);
+        if (slot != te_parser::npos)
+            {
+            std::copy_n(&m_sharedLanes[static_cast<size_t>(slot) * count], count, gradient);
+            return *var;
+            }
+        for (size_t k = 0; k < count; ++k)
+            {
+            gradient[k] = (var == variables[k]) ? 1 : 0;
+            }
+        return *var;
+        }
+    if (is_function0(texp->m_value) &&
+        (is_pure(texp->m_type) || get_function0(texp->m_value) == te_builtins::te_random))
+        {
+        std::fill_n(gradient, count, 0);
+        return get_function0(texp->m_value)();
+        }
+
+    if (is_function1(texp->m_value))
+        {
+        std::vector<te_type> du(count);
+        const te_type u = te_eval_gradient(texp->m_parameters[0], variables, du.data());
+        const auto func = get_function1(texp->m_value);
+        const te_type value = func(u);
+        // derivative of func at u
+        te_type slope{ te_nan };
+        if (func == te_builtins::te_negate)
+            {
+            slope = -1;
+            }
+        else if (te_builtins::te_ipow_exponent(func) != 0)
+            {
+            const auto exponent = te_builtins::te_ipow_exponent(func);
+            slope = exponent * std::pow(u, static_cast<te_type>(exponent - 1));
+            }
+        else if (func == te_builtins::te_sqrt)
+            {
+            slope = 1 / (2 * value);
+            }
+        else if (func == te_builtins::te_absolute_value)
+            {
+            slope = (u > 0) ? 1 : ((u < 0) ? -1 : 0);
+            }
+        else if (func == te_builtins::te_exp)
+            {
+            slope = value;
+            }
+        else if (func == te_builtins::te_log)
+            {
+            slope = 1 / u;
+            }
+        else if (func == te_builtins::te_log10)
+            {
+            slope = 1 / (u * std::log(static_cast<te_type>(10)));
+            }
+        else if (func == te_builtins::te_sin)
+            {
+            slope = std::cos(u);
+            }
+        else if (func == te_builtins::te_cos)
+            {
+            slope = -std::sin(u);
+            }
+        else if (func == te_builtins::te_tan)
+            {
+            slope = 1 + value * value;
+            }
+        else if (func == te_builtins::te_cot)
+            {
+            slope = -(1 + value * value);
+            }
+        else if (func == te_builtins::te_asin)
+            {
+            slope = 1 / std::sqrt(1 - u * u);
+            }
+        else if (func == te_builtins::te_acos)
+            {
+            slope = -1 / std::sqrt(1 - u * u);
+            }
+        else if (func == te_builtins::te_atan)
+            {
+            slope = 1 / (1 + u * u);
+            }
+        else if (func == te_builtins::te_sinh)
+            {
+            slope = std::cosh(u);
+            }
+        else if (func == te_builtins::te_cosh)
+            {
+            slope = std::sinh(u);
+            }
+        else if (func == te_builtins::te_tanh)
+            {
+            slope = 1 - value * value;
+            }
+        else if (func == te_builtins::te_floor || func == te_builtins::te_ceil ||
+                 func == te_builtins::te_trunc || func == te_builtins::te_sign)
+            {
+            slope = 0;
+            }
+        for (size_t k = 0; k < count; ++k)
+            {
+            gradient[k] = (du[k] == 0) ? 0 : slope * du[k];
+            }
+        return value;
+        }
+
+    if (is_function2(texp->m_value))
+        {
+        std::vector<te_type> du(count), dv(count);
+        const te_type u = te_eval_gradient(texp->m_parameters[0], variables, du.data());
+        const te_type v = te_eval_gradient(texp->m_parameters[1], variables, dv.data());
+        const auto func = get_function2(texp->m_value);
+        const te_type value = func(u, v);
+        // partial derivatives of func with respect to u and v
+        te_type slopeU{ te_nan }, slopeV{ te_nan };
+        if (func == te_builtins::te_add)
+            {
+            slopeU = 1;
+            slopeV = 1;
+            }
+        else if (func == te_builtins::te_sub)
+            {
+            slopeU = 1;
+            slopeV = -1;
+            }
+        else if (func == te_builtins::te_mul)
+            {
+            slopeU = v;
+            slopeV = u;
+            }
+        else if (func == te_builtins::te_divide)
+            {
+            slopeU = 1 / v;
+            slopeV = -u / (v * v);
+            }
+        else if (func == te_builtins::te_pow)
+            {
+            slopeU = (v == 0) ? 0 : v * std::pow(u, v - 1);
+            slopeV = value * std::log(u);
+            }
+        else if (func == te_builtins::te_atan2)
+            {
+            slopeU = v / (u * u + v * v);
+            slopeV = -u / (u * u + v * v);
+            }
+        // a zero partial contributes nothing even where the other slope is undefined
+        for (size_t k = 0; k < count; ++k)
+            {
+            gradient[k] = ((du[k] == 0) ? 0 : slopeU * du[k]) + ((dv[k] == 0) ? 0 : slopeV * dv[k]);
+            }
+        return value;
+        }
+
+    std::fill_n(gradient, count, te_nan);
+    return te_nan;
+    }
+
+//--------------------------------------------------
+void te_parser::optimize(te_expr* texp)
+    {
+    if (texp == nullptr)
+        {
+        return;
+        }
+    /* Evaluates as much as possible. */
+    if (is_constant(texp->m_value) || is_variable(texp->m_value))
+        {
+        return;
+        }
+
+    /* Only optimize out functions flagged as pure. */
+    if (is_pure(texp->m_type))
+        {
+        const auto arity = get_arity(texp->m_value);
+        bool known{ true };
+        for (int i = 0; i < arity; ++i)
+            {
+            if (texp->m_parameters[i] == nullptr)
+                {
+                break;
+                }
+            optimize(texp->m_parameters[i]);
+            if (!is_constant(texp->m_parameters[i]->m_value))
+                {
+                known = false;
+                }
+            }
+        if (known)
+            {
+            const auto value = te_eval(texp);
+            texp->m_parameters.clear();
+            texp->m_type = TE_DEFAULT;
+            texp->m_value = value;
+            }
+        }
+    }
+
+//--------------------------------------------------
+void te_parser::eliminate_common_subexpressions()
+    {
+    // structurally identical subtrees get the same id: a node is keyed by its kind
+    // (variant index), constant value or variable/function address, and its children's ids
+    using node_key = std::tuple<size_t, te_type, uint64_t, std::vector<size_t>>;
+    std::map<node_key, size_t> keyIds;
+    std::map<const te_expr*, size_t> nodeIds;
+    std::vector<size_t> uses;
+    std::vector<bool> shareable;
+
+    const auto uniqueId = [&uses, &shareable]()
+    {
+        uses.push_back(1);
+        shareable.push_back(false);
+        return uses.size() - 1;
+    };
+
+    const std::function<size_t(const te_expr*)> number = [&](const te_expr* texp) -> size_t
+    {
+        if (texp == nullptr)
+            {
+            return uniqueId();
+            }
+        node_key key{ texp->m_value.index(), 0, 0, {} };
+        bool canShare{ false };
+        if (is_constant(texp->m_value))
+            {
+            if (std::isnan(get_constant(texp->m_value)))
+                {
+                return uniqueId();
+                }
+            std::get<1>(key) = get_constant(texp->m_value);
+            std::get<2>(key) = std::signbit(get_constant(texp->m_value)) ? 1 : 0;
+            }
+        else if (is_variable(texp->m_value))
+            {
+            std::get<2>(key) = reinterpret_cast<uintptr_t>(get_variable(texp->m_value));
+            }
+        else
+            {
+            const size_t paramCount = texp->m_parameters.size() - (is_closure(texp->m_value) ? 1 : 0);
+            canShare = is_function(texp->m_value) && is_pure(texp->m_type) &&
+                       get_arity(texp->m_value) > 0;
+            for (size_t i = 0; i < paramCount; ++i)
+                {
+                const te_expr* param = texp->m_parameters[i];
+                const size_t childId = number(param);
+                std::get<3>(key).push_back(childId);
+                if (param == nullptr ||
+                    (!is_constant(param->m_value) && !is_variable(param->m_value) && !shareable[childId]))
+                    {
+                    canShare = false;
+                    }
+                }
+            if (!canShare)
+                {
+                nodeIds[texp] = uniqueId();
+                return nodeIds[texp];
+                }
+            std::get<2>(key) = std::visit(
+                [](const auto& var) -> uint64_t
+                {
+                    using T = std::decay_t<decltype(var)>;
+                    if constexpr (te_is_function_v<T>)
+                        {
+                        return reinterpret_cast<uintptr_t>(var);
+                        }
+                    else
+                        {
+                        return 0;
+                        }
+                },
+                texp->m_value);
+            }
+        const auto [pos, inserted] = keyIds.try_emplace(key, uses.size());
+        if (inserted)
+            {
+            uses.push_back(0);
+            shareable.push_back(canShare);
+            }
+        ++uses[pos->second];
+        nodeIds[texp] = pos->second;
+        return pos->second;
+    };
+    number(m_compiledExpression);
+
+    size_t sharedCount{ 0 };
+    for (size_t id = 0; id < uses.size(); ++id)
+        {
+        sharedCount += (shareable[id] && uses[id] > 1) ? 1 : 0;
+        }
+    if (sharedCount == 0)
+        {
+        return;
+        }
+    // the slots must not move once variables point at them
+    m_sharedValues.reserve(sharedCount);
+    std::vector<size_t> slots(uses.size(), static_cast<size_t>(te_parser::npos));
+
+    const auto bindToSlot = [this](te_expr* texp, const size_t slot)
+    {
+        texp->m_parameters.clear();
+        texp->m_type = TE_DEFAULT;
+        texp->m_value = static_cast<const te_type*>(&m_sharedValues[slot]);
+    };
+
+    // the first occurrence is moved out (after its own shared parts), later ones are dropped
+    const std::function<void(te_expr*)> hoist = [&](te_expr* texp)
+    {
+        if (texp == nullptr || is_constant(texp->m_value) || is_variable(texp->m_value))
+            {
+            return;
+            }
+        const size_t id = nodeIds[texp];
+        const bool shared = shareable[id] && uses[id] > 1;
+        if (shared && slots[id] != static_cast<size_t>(te_parser::npos))
+            {
+            bindToSlot(texp, slots[id]);
+            return;
+            }
+        const size_t paramCount = texp->m_parameters.size() - (is_closure(texp->m_value) ? 1 : 0);
+        for (size_t i = 0; i < paramCount; ++i)
+            {
+            hoist(texp->m_parameters[i]);
+            }
+        if (shared)
+            {
+            auto* sharedExpr = allocate_expr(texp->m_type, texp->m_value, 0);
+            sharedExpr->m_parameters = texp->m_parameters;
+            slots[id] = m_sharedExpressions.size();
+            m_sharedExpressions.push_back(sharedExpr);
+            m_sharedValues.push_back(te_nan);
+            bindToSlot(texp, slots[id]);
+            }
+    };
+    hoist(m_compiledExpression);
+    }
+
+//--------------------------------------------------
+std::string te_parser::generate_c_node(const te_expr* texp, std::string& source,
+                                       size_t& tempCount) const
+    {
+    if (texp == nullptr)
+        {
+        return {};
+        }
+    const auto newTemp = [&source, &tempCount](const std::string& value)
+    {
+        const std::string name = "t" + std::to_string(tempCount++);
+        source.append("\tconst double ").append(name).append(" = ").append(value).append(";\n");
+        return name;
+    };
+
+    if (is_constant(texp->m_value))
+        {
+        // hexadecimal literals keep the exact value
+        std::array<char, 64> buffer{};
+        std::snprintf(buffer.data(), buffer.size(), "%a",
+                      static_cast<double>(get_constant(texp->m_value)));
+        return newTemp(std::isfinite(get_constant(texp->m_value)) ?
+                           std::string(buffer.data()) :
+                           (std::isnan(get_constant(texp->m_value)) ?
+                                "NAN" :
+                                (get_constant(texp->m_value) > 0 ? "INFINITY" : "-INFINITY")));
+        }
+    if (is_variable(texp->m_value))
+        {
+        const te_type* var = get_variable(texp->m_value);
+        const auto slot = get_shared_index(var);
+        if (slot != te_parser::npos)
+            {
+            return "s" + std::to_string(slot);
+            }
+        for (size_t i = 0; i < m_indexedCount; ++i)
+            {
+            if (var == m_indexedValues + i * m_indexedStride)
+                {
+                return newTemp("x[" + std::to_string(i * m_indexedStride) + "]");
+                }
+            }
+        return {};
+        }
+
+    if (!is_pure(texp->m_type))
+        {
+        return {};
+        }
+    std::vector<std::string> args;
+    if (is_function1(texp->m_value) || is_function2(texp->m_value))
+        {
+        for (const auto* param : texp->m_parameters)
+            {
+            args.push_back(generate_c_node(param, source, tempCount));
+            if (args.back().empty())
+                {
+                return {};
+                }
+            }
+        }
+
+    if (is_function1(texp->m_value))
+        {
+        const auto func = get_function1(texp->m_value);
+        const std::string& a = args[0];
+        const auto exponent = te_builtins::te_ipow_exponent(func);
+        if (exponent != 0)
+            {
+            // the same squaring chain as te_ipow
+            const auto power = [&](const auto& self, const unsigned n) -> std::string
+            {
+                if (n == 1)
+                    {
+                    return a;
+                    }
+                const std::string half = self(self, n / 2);
+                return newTemp(half + " * " + half + ((n % 2 == 0) ? "" : " * " + a));
+            };
+            return power(power, exponent);
+            }
+        const std::vector<std::pair<te_fun1, const char*>> calls = {
+            { te_builtins::te_absolute_value, "fabs" }, { te_builtins::te_acos, "acos" },
+            { te_builtins::te_asin, "asin" },           { te_builtins::te_atan, "atan" },
+            { te_builtins::te_ceil, "ceil" },           { te_builtins::te_cos, "cos" },
+            { te_builtins::te_cosh, "cosh" },           { te_builtins::te_exp, "exp" },
+            { te_builtins::te_floor, "floor" },         { te_builtins::te_log, "log" },
+            { te_builtins::te_log10, "log10" },         { te_builtins::te_sin, "sin" },
+            { te_builtins::te_sinh, "sinh" },           { te_builtins::te_tan, "tan" },
+            { te_builtins::te_tanh, "tanh" },           { te_builtins::te_trunc, "trunc" }
+        };
+        for (const auto& [builtin, name] : calls)
+            {
+            if (func == builtin)
+                {
+                return newTemp(std::string(name) + "(" + a + ")");
+                }
+            }
+        if (func == te_builtins::te_negate)
+            {
+            return newTemp("-" + a);
+            }
+        if (func == te_builtins::te_sqr)
+            {
+            return newTemp(a + " * " + a);
+            }
+        if (func == te_builtins::te_sqrt)
+            {
+            return newTemp("(" + a + " < 0) ? NAN : sqrt(" + a + ")");
+            }
+        if (func == te_builtins::te_cot)
+            {
+            return newTemp("(" + a + " == 0) ? NAN : 1 / tan(" + a + ")");
+            }
+        if (func == te_builtins::te_sign)
+            {
+            return newTemp("(" + a + " < 0) ? -1.0 : ((" + a + " > 0) ? 1.0 : 0.0)");
+            }
+        return {};
+        }
+
+    if (is_function2(texp->m_value))
+        {
+        const auto func = get_function2(texp->m_value);
+        const std::string& a = args[0];
+        const std::string& b = args[1];
+        if (func == te_builtins::te_add)
+            {
+            return newTemp(a + " + " + b);
+            }
+        if (func == te_builtins::te_sub)
+            {
+            return newTemp(a + " - " + b);
+            }
+        if (func == te_builtins::te_mul)
+            {
+            return newTemp(a + " * " + b);
+            }
+        if (func == te_builtins::te_divide)
+            {
+            return newTemp("(" + b + " == 0) ? NAN : " + a + " / " + b);
+            }
+        if (func == te_builtins::te_pow)
+            {
+            return newTemp("pow(" + a + ", " + b + ")");
+            }
+        if (func == te_builtins::te_atan2)
+            {
+            return newTemp("atan2(" + a + ", " + b + ")");
+            }
+        }
+    return {};
+    }
+
+//--------------------------------------------------
+bool te_parser::generate_c_source(std::string& source) const
+    {
+    source.clear();
+    if (m_compiledExpression == nullptr || !std::is_same_v<te_type, double>)
+        {
+        return false;
+        }
+    size_t tempCount{ 0 };
+    for (size_t i = 0; i < m_sharedExpressions.size(); ++i)
+        {
+        const std::string value = generate_c_node(m_sharedExpressions[i], source, tempCount);
+        if (value.empty())
+            {
+            return false;
+            }
+        source.append("\tconst double s").append(std::to_string(i)).append(" = ").append(value).append(";\n");
+        }
+    const std::string result = generate_c_node(m_compiledExpression, source, tempCount);
+    if (result.empty())
+        {
+        source.clear();
+        return false;
+        }
+    source.append("\treturn ").append(result).append(";\n");
+    return true;
+    }
+
+//--------------------------------------------------
+size_t te_parser::te_eval_base(const te_expr* texp, std::vector<const te_type*>& dependencies,
+                               bool& isVolatile)
+    {
+    te_base_node node{ texp, {} };
+    dependencies.clear();
+    isVolatile = false;
+    if (texp != nullptr && is_variable(texp->m_value))
+        {
+        const te_type* var = get_variable(texp->m_value);
+        const auto slot = get_shared_index(var);
+        if (slot != te_parser::npos)
+            {
+            // shared subexpressions are recorded before the expression using them
+            const auto& shared = m_sharedBaseNodes[static_cast<size_t>(slot)];
+            node.m_parameters.push_back(shared.m_index);
+            dependencies = shared.m_dependencies;
+            isVolatile = shared.m_volatile;
+            }
+        else
+            {
+            dependencies.push_back(var);
+            }
+        }
+    else if (texp != nullptr && !is_constant(texp->m_value))
+        {
+        isVolatile = !is_pure(texp->m_type) || is_closure(texp->m_value);
+        const size_t paramCount = texp->m_parameters.size() - (is_closure(texp->m_value) ? 1 : 0);
+        std::vector<const te_type*> paramDependencies;
+        for (size_t i = 0; i < paramCount; ++i)
+            {
+            if (texp->m_parameters[i] == nullptr)
+                {
+                node.m_parameters.push_back(static_cast<size_t>(te_parser::npos));
+                continue;
+                }
+            bool paramVolatile{ false };
+            node.m_parameters.push_back(
+                te_eval_base(texp->m_parameters[i], paramDependencies, paramVolatile));
+            isVolatile = isVolatile || paramVolatile;
+            dependencies.insert(dependencies.end(), paramDependencies.cbegin(),
+                                paramDependencies.cend());
+            }
+        std::sort(dependencies.begin(), dependencies.end(), std::less<>{});
+        dependencies.erase(std::unique(dependencies.begin(), dependencies.end()),
+                           dependencies.end());
+        }
+
+    const size_t index = m_baseNodes.size();
+    m_baseNodes.push_back(std::move(node));
+    m_baseValues.push_back(te_eval_base_node(index, m_baseValues));
+    for (const auto* var : dependencies)
+        {
+        m_dirtyNodes[var].push_back(index);
+        }
+    if (isVolatile)
+        {
+        m_volatileNodes.push_back(index);
+        }
+    return index;
+    }
+
+//--------------------------------------------------
+te_type te_parser::te_eval_base_node(const size_t index, const std::vector<te_type>& values) const
+    {
+    const te_base_node& node = m_baseNodes[index];
+    const te_expr* texp = node.m_expr;
+    if (texp == nullptr)
+        {
+        return te_nan;
+        }
+    if (is_constant(texp->m_value))
+        {
+        return get_constant(texp->m_value);
+        }
+    if (is_variable(texp->m_value))
+        {
+        return node.m_parameters.empty() ? *get_variable(texp->m_value) :
+                                           values[node.m_parameters.front()];
+        }
+    return te_apply_function(texp->m_value,
+                             is_closure(texp->m_value) ? texp->m_parameters.back() : nullptr,
+                             [&node, &values](const size_t e)
+                             {
+                                 return (e < node.m_parameters.size() &&
+                                         node.m_parameters[e] != static_cast<size_t>(te_parser::npos)) ?
+                                            values[node.m_parameters[e]] :
+                                            te_nan;
+                             });
+    }
+
+//--------------------------------------------------
+te_type te_parser::evaluate_base()
+    {
+    clear_base();
+    try
+        {
+        std::vector<const te_type*> dependencies;
+        bool isVolatile{ false };
+        for (size_t i = 0; i < m_sharedExpressions.size(); ++i)
+            {
+            const size_t index = te_eval_base(m_sharedExpressions[i], dependencies, isVolatile);
+            m_sharedBaseNodes.push_back({ index, dependencies, isVolatile });
+            m_sharedValues[i] = m_baseValues[index];
+            }
+        m_result = (m_compiledExpression != nullptr) ?
+                       m_baseValues[te_eval_base(m_compiledExpression, dependencies, isVolatile)] :
+                       te_nan;
+        }
+    catch (const std::exception& expt)
+        {
+        clear_base();
+        m_parseSuccess = false;
+        m_result = te_nan;
+        m_lastErrorMessage = expt.what();
+        }
+
+    reset_usr_resolved_if_necessary();
+
+    return m_result;
+    }
+
+//--------------------------------------------------
+te_type te_parser::evaluate_changed(const te_type* variable)
+    {
+    if (m_compiledExpression == nullptr || m_baseNodes.empty())
+        {
+        return evaluate();
+        }
+    try
+        {
+        m_changedNodes.clear();
+        const auto dirty = m_dirtyNodes.find(variable);
+        if (dirty != m_dirtyNodes.cend())
+            {
+            std::set_union(dirty->second.cbegin(), dirty->second.cend(), m_volatileNodes.cbegin(),
+                           m_volatileNodes.cend(), std::back_inserter(m_changedNodes));
+            }
+        else
+            {
+            m_changedNodes = m_volatileNodes;
+            }
+        // the changed nodes are computed in place, their base values are kept to be put back
+        m_changedValues.clear();
+        for (const auto index : m_changedNodes)
+            {
+            m_changedValues.push_back(m_baseValues[index]);
+            m_baseValues[index] = te_eval_base_node(index, m_baseValues);
+            }
+        m_result = m_baseValues.back();
+        }
+    catch (const std::exception& expt)
+        {
+        m_parseSuccess = false;
+        m_result = te_nan;
+        m_lastErrorMessage = expt.what();
+        }
+    for (size_t i = 0; i < m_changedValues.size(); ++i)
+        {
+        m_baseValues[m_changedNodes[i]] = m_changedValues[i];
+        }
+
+    reset_usr_resolved_if_necessary();
+
+    return m_result;
+    }
+
+//--------------------------------------------------
+void te_parser::evaluate_shared()
+    {
+    for (size_t i = 0; i < m_sharedExpressions.size(); ++i)
+        {
+        m_sharedValues[i] = te_eval(m_sharedExpressions[i]);
+        }
+    }
+
+//--------------------------------------------------
+void te_parser::replace_with_parameter(te_expr* texp, const size_t index)
+    {
+    te_expr* param = texp->m_parameters[index];
+    texp->m_type = param->m_type;
+    texp->m_value = param->m_value;
+    texp->m_parameters = param->m_parameters;
+    }
+
+//--------------------------------------------------
+void te_parser::simplify(te_expr* texp)
+    {
+    if (texp == nullptr || is_constant(texp->m_value) || is_variable(texp->m_value))
+        {
+        return;
+        }
+    const size_t paramCount = texp->m_parameters.size() - (is_closure(texp->m_value) ? 1 : 0);
+    for (size_t i = 0; i < paramCount; ++i)
+        {
+        simplify(texp->m_parameters[i]);
+        }
+    if (!is_pure(texp->m_type))
+        {
+        return;
+        }
+
+    const auto isConstant = [texp](const size_t index, const te_type value)
+    {
+        const te_expr* param = texp->m_parameters[index];
+        return param != nullptr && is_constant(param->m_value) && get_constant(param->m_value) == value;
+    };
+
+    if (is_function2(texp->m_value))
+        {
+        const auto func = get_function2(texp->m_value);
+        if (func == te_builtins::te_mul)
+            {
+            // x * 0 is left alone, it is NaN for an infinite or NaN x
+            if (isConstant(0, 1))
+                {
+                replace_with_parameter(texp, 1);
+                }
+            else if (isConstant(1, 1))
+                {
+                replace_with_parameter(texp, 0);
+                }
+            }
+        else if (func == te_builtins::te_add)
+            {
+            if (isConstant(0, 0))
+                {
+                replace_with_parameter(texp, 1);
+                }
+            else if (isConstant(1, 0))
+                {
+                replace_with_parameter(texp, 0);
+                }
+            }
+        else if (func == te_builtins::te_sub)
+            {
+            if (isConstant(1, 0))
+                {
+                replace_with_parameter(texp, 0);
+                }
+            }
+        else if (func == te_builtins::te_divide)
+            {
+            const te_expr* divisor = texp->m_parameters[1];
+            if (divisor != nullptr && is_constant(divisor->m_value) &&
+                get_constant(divisor->m_value) != 0 && std::isfinite(get_constant(divisor->m_value)))
+                {
+                texp->m_parameters[1]->m_value = 1 / get_constant(divisor->m_value);
+                texp->m_value = static_cast<te_fun2>(te_builtins::te_mul);
+                if (isConstant(1, 1))
+                    {
+                    replace_with_parameter(texp, 0);
+                    }
+                }
+            }
+        else if (func == te_builtins::te_pow)
+            {
+            const te_expr* exponent = texp->m_parameters[1];
+            if (exponent != nullptr && is_constant(exponent->m_value))
+                {
+                const te_type value = get_constant(exponent->m_value);
+                if (value == 1)
+                    {
+                    replace_with_parameter(texp, 0);
+                    }
+                else if (value >= 2 && value < std::size(te_builtins::te_ipow_functions) &&
+                         value == std::floor(value))
+                    {
+                    texp->m_parameters.resize(1);
+                    texp->m_value = te_builtins::te_ipow_functions[static_cast<size_t>(value)];
+                    }
+                }
+            }
+        }
+    else if (is_function1(texp->m_value))
+        {
+        // sqrt(sqr(x)) is |x|
+        const te_expr* param = texp->m_parameters[0];
+        if (get_function1(texp->m_value) == te_builtins::te_sqrt && param != nullptr &&
+            is_function1(param->m_value) && get_function1(param->m_value) == te_builtins::te_sqr)
+            {
+            replace_with_parameter(texp, 0);
+            texp->m_value = static_cast<te_fun1>(te_builtins::te_absolute_value);
+            }
+        }
+    }
+
+//--------------------------------------------------
+te_expr* te_parser::te_compile(const std::string_view expression, std::set<te_variable>& variables)
+    {
+    state theState(expression.data(), TE_DEFAULT, variables);
+
+    next_token(&theState);
+    te_expr* root = list(&theState);
+
+    if (theState.m_type != te_parser::state::token_type::TOK_END)
+        {
+        m_errorPos = (theState.m_next - theState.m_start);
+        if (m_errorPos > 0)
+            {
+            --m_errorPos;
+            }
+        return nullptr;
+        }
+
+    optimize(root);
+    simplify(root);
+    m_errorPos = te_parser::npos;
+    return root;
+    }
+
+//--------------------------------------------------
+bool te_parser::compile(const std::string_view expression)
+    {
+    reset_state();
+    if (get_list_separator() == get_decimal_separator())
+        {
+        throw std::runtime_error("List and decimal separators cannot be the same");
+        }
+    if (expression.empty())
+        {
+        m_expression.clear();
+        m_errorPos = 0;
+        return false;
+        }
+    m_expression.assign(expression);
+
+    // In case the expression was a spreadsheet formula like "=SUM(...)",
+    // remove the '=' in front.
+    if ((m_expression.length() > 0) && m_expression.front() == '=')
+        {
+        m_expression.erase(0, 1);
+        }
+
+    size_t commentStart{ 0 };
+    while (commentStart != std::string::npos)
+        {
+        commentStart = m_expression.find('/', commentStart);
+        if (commentStart == std::string::npos || commentStart == m_expression.length() - 1)
+            {
+            break;
+            }
+        // remove multi-line comments
+        if (m_expression[commentStart + 1] == '*')
+            {
+            auto commentEnd = m_expression.find("*/", commentStart);
+            if (commentEnd == std::string::npos)
+                {
+                m_errorPos = static_cast<decltype(m_errorPos)>(commentStart);
+                m_parseSuccess = false;
+                m_result = te_nan;
+                return false;
+                }
+            m_expression.erase(commentStart, (commentEnd + 2) - commentStart);
+            }
+        // remove single-line comments
+        else if (m_expression[commentStart + 1] == '/')
+            {
+            auto commentEnd = m_expression.find_first_of("\n\r", commentStart);
+            if (commentEnd == std::string::npos)
+                {
+                m_expression.erase(commentStart);
+                break;
+                }
+            m_expression.erase(commentStart, commentEnd - commentStart);
+            }
+        else
+            {
+            ++commentStart;
+            }
+        }
+
+    // about one node per character, so the whole tree usually fits in one block
+    m_arena.reserve((m_expression.length() + 1) * (sizeof(te_expr) + 2 * sizeof(te_expr*)));
+
+    try
         {
         m_compiledExpression = te_compile(m_expression, get_variables_and_functions());
         m_parseSuccess = (m_compiledExpression != nullptr);
+        if (m_parseSuccess)
+            {
+            eliminate_common_subexpressions();
+            }
         }
     catch (const std::exception& expt)
         {
@@ -2561,7 +3816,15 @@ te_type te_parser::evaluate()
     {
     try
         {
-        m_result = (m_compiledExpression != nullptr) ? te_eval(m_compiledExpression) : te_nan;
+        if (m_compiledExpression != nullptr)
+            {
+            evaluate_shared();
+            m_result = te_eval(m_compiledExpression);
+            }
+        else
+            {
+            m_result = te_nan;
+            }
         }
     catch (const std::exception& expt)
         {
@@ -2575,6 +3838,72 @@ te_type te_parser::evaluate()
     return m_result;
     }
 
+//--------------------------------------------------
+bool te_parser::evaluate_batch(const size_t lanes, te_type* results)
+    {
+    if (m_compiledExpression == nullptr)
+        {
+        std::fill_n(results, lanes, te_nan);
+        return false;
+        }
+    evaluate_batch_lanes(lanes, results);
+    return true;
+    }
+
+//--------------------------------------------------
+bool te_parser::evaluate_batch_float(const size_t lanes, float* results)
+    {
+    if (m_compiledExpression == nullptr)
+        {
+        std::fill_n(results, lanes, std::numeric_limits<float>::quiet_NaN());
+        return false;
+        }
+    evaluate_batch_lanes(lanes, results);
+    return true;
+    }
+
+//--------------------------------------------------
+template<typename L>
+void te_parser::evaluate_batch_lanes(const size_t lanes, L* results)
+    {
+    std::vector<L>& sharedLanes = get_shared_lanes<L>();
+    sharedLanes.resize(m_sharedExpressions.size() * lanes);
+    for (size_t i = 0; i < m_sharedExpressions.size(); ++i)
+        {
+        te_eval_batch(m_sharedExpressions[i], lanes, &sharedLanes[i * lanes]);
+        }
+    te_eval_batch(m_compiledExpression, lanes, results);
+    reset_usr_resolved_if_necessary();
+    }
+
+//--------------------------------------------------
+te_type te_parser::evaluate_gradient(const std::vector<const te_type*>& variables,
+                                     std::vector<te_type>& gradient)
+    {
+    gradient.assign(variables.size(), te_nan);
+    if (m_compiledExpression == nullptr)
+        {
+        return te_nan;
+        }
+    try
+        {
+        m_sharedLanes.resize(m_sharedExpressions.size() * variables.size());
+        for (size_t i = 0; i < m_sharedExpressions.size(); ++i)
+            {
+            m_sharedValues[i] = te_eval_gradient(m_sharedExpressions[i], variables,
+                                                 &m_sharedLanes[i * variables.size()]);
+            }
+        const te_type value = te_eval_gradient(m_compiledExpression, variables, gradient.data());
+        reset_usr_resolved_if_necessary();
+        return value;
+        }
+    catch (const std::exception&)
+        {
+        std::fill(gradient.begin(), gradient.end(), te_nan);
+        return te_nan;
+        }
+    }
+
 //--------------------------------------------------
 te_type
 te_parser::evaluate(const std::string_view expression) // NOLINT(-readability-identifier-naming)
@@ -2656,3 +3985,218 @@ std::string te_parser::info()
 #endif
     return sysInfo;
     }
+
+//--------------------------------------------------
+std::shared_ptr<const te_program> te_parser::get_program() const
+    {
+    if (!m_parseSuccess || m_compiledExpression == nullptr)
+        {
+        return nullptr;
+        }
+    std::shared_ptr<te_program> program(new te_program);
+    program->m_variableCount = m_indexedCount;
+    program->m_dirtyInstructions.resize(m_indexedCount);
+    std::vector<te_program::shared_instruction> shared;
+    std::vector<size_t> dependencies;
+    bool isVolatile{ false };
+    // shared subexpressions come first, so the expression can refer to them
+    for (const auto* sharedExpr : m_sharedExpressions)
+        {
+        const size_t index =
+            program->add_instructions(*this, sharedExpr, dependencies, isVolatile, shared);
+        shared.push_back({ index, dependencies, isVolatile });
+        }
+    // the expression itself is never shared, so its instruction is the last one
+    program->add_instructions(*this, m_compiledExpression, dependencies, isVolatile, shared);
+    // such a program would dangle once the parser is gone
+    if (program->m_refersToParser)
+        {
+        return nullptr;
+        }
+    return program;
+    }
+
+//--------------------------------------------------
+size_t te_program::add_instructions(const te_parser& parser, const te_expr* texp,
+                                    std::vector<size_t>& dependencies, bool& isVolatile,
+                                    const std::vector<shared_instruction>& shared)
+    {
+    dependencies.clear();
+    isVolatile = false;
+    instruction ins{ te_parser::te_nan };
+    if (texp == nullptr)
+        {
+        ins.m_value = te_parser::te_nan;
+        }
+    else if (te_parser::is_variable(texp->m_value))
+        {
+        const te_type* var = te_parser::get_variable(texp->m_value);
+        const auto slot = parser.get_shared_index(var);
+        if (slot != te_parser::npos)
+            {
+            // a shared subexpression is computed once, by its own instructions
+            const auto& sharedInstruction = shared[static_cast<size_t>(slot)];
+            dependencies = sharedInstruction.m_dependencies;
+            isVolatile = sharedInstruction.m_volatile;
+            return sharedInstruction.m_index;
+            }
+        ins.m_value = texp->m_value;
+        const auto* first = parser.m_indexedValues;
+        if (first != nullptr && var >= first &&
+            var < first + parser.m_indexedCount * parser.m_indexedStride &&
+            (var - first) % parser.m_indexedStride == 0)
+            {
+            ins.m_variable = static_cast<size_t>(var - first) / parser.m_indexedStride;
+            dependencies.push_back(ins.m_variable);
+            }
+        else
+            {
+            m_refersToParser = true;
+            }
+        }
+    else if (te_parser::is_constant(texp->m_value))
+        {
+        ins.m_value = texp->m_value;
+        }
+    else
+        {
+        ins.m_value = texp->m_value;
+        isVolatile = !te_parser::is_pure(texp->m_type) || te_parser::is_closure(texp->m_value);
+        const bool closure = te_parser::is_closure(texp->m_value);
+        m_refersToParser = m_refersToParser || closure;
+        const size_t paramCount = texp->m_parameters.size() - (closure ? 1 : 0);
+        std::vector<size_t> operands(paramCount, npos);
+        std::vector<size_t> paramDependencies;
+        for (size_t i = 0; i < paramCount; ++i)
+            {
+            if (texp->m_parameters[i] == nullptr)
+                {
+                continue;
+                }
+            bool paramVolatile{ false };
+            operands[i] = add_instructions(parser, texp->m_parameters[i], paramDependencies,
+                                           paramVolatile, shared);
+            isVolatile = isVolatile || paramVolatile;
+            dependencies.insert(dependencies.end(), paramDependencies.cbegin(),
+                                paramDependencies.cend());
+            }
+        std::sort(dependencies.begin(), dependencies.end());
+        dependencies.erase(std::unique(dependencies.begin(), dependencies.end()),
+                           dependencies.end());
+        ins.m_firstOperand = m_operands.size();
+        ins.m_operandCount = paramCount;
+        m_operands.insert(m_operands.end(), operands.cbegin(), operands.cend());
+        }
+
+    const size_t index = m_instructions.size();
+    m_instructions.push_back(std::move(ins));
+    for (const auto var : dependencies)
+        {
+        m_dirtyInstructions[var].push_back(index);
+        }
+    if (isVolatile)
+        {
+        m_volatileInstructions.push_back(index);
+        }
+    return index;
+    }
+
+//--------------------------------------------------
+te_type te_program::execute(const size_t index, const te_context& context,
+                            const std::vector<te_type>& values) const
+    {
+    const instruction& ins = m_instructions[index];
+    if (ins.m_variable != npos)
+        {
+        return context.m_variables[ins.m_variable * context.m_stride];
+        }
+    if (te_parser::is_constant(ins.m_value))
+        {
+        return te_parser::get_constant(ins.m_value);
+        }
+    const size_t* operands = m_operands.data() + ins.m_firstOperand;
+    return te_apply_function(ins.m_value, nullptr,
+                             [&ins, operands, &values](const size_t e)
+                             {
+                                 return (e < ins.m_operandCount && operands[e] != npos) ?
+                                            values[operands[e]] :
+                                            te_parser::te_nan;
+                             });
+    }
+
+//--------------------------------------------------
+template<typename Indices>
+te_type te_program::run(te_context& context, const Indices& indices) const
+    {
+    try
+        {
+        if (m_variableCount > 0 && context.m_variables == nullptr)
+            {
+            throw std::runtime_error("No variables bound to the evaluation context.");
+            }
+        for (const size_t index : indices)
+            {
+            context.m_values[index] = execute(index, context, context.m_values);
+            }
+        context.m_result = context.m_values.back();
+        context.m_success = true;
+        }
+    catch (const std::exception& expt)
+        {
+        context.m_result = te_parser::te_nan;
+        context.m_success = false;
+        context.m_lastErrorMessage = expt.what();
+        }
+    return context.m_result;
+    }
+
+//--------------------------------------------------
+te_type te_program::evaluate(te_context& context) const
+    {
+    context.m_holdsBase = false;
+    context.m_values.resize(m_instructions.size());
+    return run(context, std::views::iota(size_t{ 0 }, m_instructions.size()));
+    }
+
+//--------------------------------------------------
+te_type te_program::evaluate_base(te_context& context) const
+    {
+    evaluate(context);
+    // a failed evaluation leaves no base, evaluate_changed() then evaluates everything
+    if (context.m_success)
+        {
+        context.m_baseValues = context.m_values;
+        context.m_holdsBase = true;
+        }
+    else
+        {
+        context.m_baseValues.clear();
+        }
+    return context.m_result;
+    }
+
+//--------------------------------------------------
+te_type te_program::evaluate_changed(te_context& context, const size_t variable) const
+    {
+    if (context.m_baseValues.size() != m_instructions.size() || variable >= m_variableCount)
+        {
+        return evaluate(context);
+        }
+    const auto& dirty = m_dirtyInstructions[variable];
+    context.m_changed.clear();
+    std::set_union(dirty.cbegin(), dirty.cend(), m_volatileInstructions.cbegin(),
+                   m_volatileInstructions.cend(), std::back_inserter(context.m_changed));
+    // evaluate() may have overwritten the base since evaluate_base()
+    if (!context.m_holdsBase)
+        {
+        context.m_values = context.m_baseValues;
+        context.m_holdsBase = true;
+        }
+    const te_type result = run(context, context.m_changed);
+    // put back what changed, so the next call starts from the base again
+    for (const size_t index : context.m_changed)
+        {
+        context.m_values[index] = context.m_baseValues[index];
+        }
+    return result;
+    }
@@ -50,10 +50,12 @@
 #ifndef __TINYEXPR_PLUS_PLUS_H__
 #define __TINYEXPR_PLUS_PLUS_H__
 #include <algorithm>
+#include <array>
 #include <cassert>
 #include <cctype>
 #include <cfloat>
 #include <cmath>
+#include <cstddef>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
@@ -61,7 +63,10 @@
 #include <ctime>
 #include <functional>
 #include <initializer_list>
+#include <iterator>
 #include <limits>
+#include <map>
+#include <memory>
 #include <random>
 #include <set>
 #include <stdexcept>
@@ -277,6 +282,55 @@ class te_string_less
         }
     };
 
+/// @brief The parameters of a te_expr, a fixed-size array of expression pointers.
+/// @details The array belongs to the arena of the parser that built the expression.
+///     It is never reallocated and can only shrink.
+class te_expr_parameters
+    {
+  public:
+    /// @private
+    te_expr_parameters() noexcept = default;
+    /// @private
+    te_expr_parameters(te_expr** data, const size_t size) noexcept : m_data(data), m_size(size) {}
+
+    [[nodiscard]]
+    size_t size() const noexcept
+        {
+        return m_size;
+        }
+
+    [[nodiscard]]
+    bool empty() const noexcept
+        {
+        return m_size == 0;
+        }
+
+    te_expr*& operator[](const size_t index) noexcept { return m_data[index]; }
+
+    te_expr* const& operator[](const size_t index) const noexcept { return m_data[index]; }
+
+    te_expr** begin() noexcept { return m_data; }
+
+    te_expr** end() noexcept { return m_data + m_size; }
+
+    te_expr* const* begin() const noexcept { return m_data; }
+
+    te_expr* const* end() const noexcept { return m_data + m_size; }
+
+    te_expr* const& front() const noexcept { return m_data[0]; }
+
+    te_expr* const& back() const noexcept { return m_data[m_size - 1]; }
+
+    void clear() noexcept { m_size = 0; }
+
+    /// @brief Drops the parameters past @c size; the array cannot grow.
+    void resize(const size_t size) noexcept { m_size = std::min(m_size, size); }
+
+  private:
+    te_expr** m_data{ nullptr };
+    size_t m_size{ 0 };
+    };
+
 /// @brief A compiled expression.
 /// @details Can also be an additional object that can be passed to
 ///     te_confun0-te_confun7 functions via a te_variable.
@@ -305,7 +359,42 @@ class te_expr
     /// @brief The te_type constant, te_type pointer, or function to bind to.
     te_variant_type m_value{ static_cast<te_type>(0.0) };
     /// @brief Additional parameters.
-    std::vector<te_expr*> m_parameters{ nullptr };
+    te_expr_parameters m_parameters;
+    };
+
+/// @brief Bump allocator for the nodes of compiled expressions.
+/// @details Nodes are never freed one by one. reset() releases a whole
+///     expression at once and keeps the largest block for the next one.
+class te_expr_arena
+    {
+  public:
+    /// @private
+    te_expr_arena() = default;
+    /// @private
+    te_expr_arena(const te_expr_arena&) = delete;
+    /// @private
+    te_expr_arena& operator=(const te_expr_arena&) = delete;
+
+    /// @brief Makes sure that @c size bytes can be allocated without adding a block.
+    void reserve(const size_t size);
+    /// @returns @c size bytes aligned for any expression node.
+    [[nodiscard]]
+    void* allocate(size_t size);
+    /// @brief Releases everything allocated so far.
+    void reset() noexcept;
+
+  private:
+    struct block
+        {
+        std::unique_ptr<std::byte[]> m_data;
+        size_t m_size{ 0 };
+        };
+
+    void add_block(const size_t size);
+
+    std::vector<block> m_blocks;
+    // bytes used in the last block
+    size_t m_used{ 0 };
     };
 
 /// @brief Custom variable or function that can be added to a te_parser.
@@ -335,9 +424,13 @@ class te_variable
     te_expr* m_context{ nullptr };
     };
 
+class te_program;
+
 /// @brief Math formula parser.
 class te_parser
     {
+    friend class te_program;
+
   public:
     /// @private
     te_parser() = default;
@@ -348,7 +441,11 @@ class te_parser
         : m_customFuncsAndVars(that.m_customFuncsAndVars),
           m_unknownSymbolResolve(that.m_unknownSymbolResolve),
           m_keepResolvedVariables(that.m_keepResolvedVariables),
-          m_decimalSeparator(that.m_decimalSeparator), m_listSeparator(that.m_listSeparator)
+          m_decimalSeparator(that.m_decimalSeparator), m_listSeparator(that.m_listSeparator),
+          m_indexedValues(that.m_indexedValues), m_indexedCount(that.m_indexedCount),
+          m_indexedStride(that.m_indexedStride), m_indexedPrefix(that.m_indexedPrefix),
+          m_indexedParameterCount(that.m_indexedParameterCount),
+          m_indexedParameterPrefix(that.m_indexedParameterPrefix)
         {
         }
 
@@ -360,6 +457,12 @@ class te_parser
         m_keepResolvedVariables = that.m_keepResolvedVariables;
         m_decimalSeparator = that.m_decimalSeparator;
         m_listSeparator = that.m_listSeparator;
+        m_indexedValues = that.m_indexedValues;
+        m_indexedCount = that.m_indexedCount;
+        m_indexedStride = that.m_indexedStride;
+        m_indexedPrefix = that.m_indexedPrefix;
+        m_indexedParameterCount = that.m_indexedParameterCount;
+        m_indexedParameterPrefix = that.m_indexedParameterPrefix;
 
         reset_state();
 
@@ -367,7 +470,7 @@ class te_parser
         }
 
     /// @private
-    ~te_parser() { te_free(m_compiledExpression); }
+    ~te_parser() = default;
 
     /// @brief NaN (not-a-number) constant to indicate an invalid value.
     constexpr static auto te_nan = std::numeric_limits<te_type>::quiet_NaN();
@@ -414,6 +517,15 @@ class te_parser
         return maxBit + (maxBit - 1);
         }
 
+    /// @brief Reseeds the @c rand() generator of the calling thread.
+    /// @details Every thread has its own generator, so callers that derive
+    ///     @c stream from what they evaluate (e.g., the lane or the point) rather
+    ///     than from the order of evaluation get the same numbers whichever
+    ///     thread does the work.
+    /// @param seed The session seed.
+    /// @param stream The stream within the session.
+    static void set_random_stream(const uint64_t seed, const uint64_t stream);
+
     /** @brief Parses the input @c expression.
         @param expression The formula to compile.
         @returns Whether the expression compiled or not. (This can be checked
@@ -437,6 +549,69 @@ class te_parser
             (e.g., `1 << 64` would cause an overflow).*/
     [[nodiscard]]
     te_type evaluate(const std::string_view expression);
+    /** @brief Evaluates the expression passed to compile() previously for several
+            sets of variable values in one pass over the expression tree.
+        @details Every variable bound to the parser must point to an array of
+            @c lanes consecutive values; lane @c i of the results is computed
+            from element @c i of each of those arrays.
+        @param lanes The number of value sets.
+        @param[out] results Receives @c lanes results. A lane whose evaluation
+            fails (e.g., division by zero) is set to NaN without affecting the other lanes.
+        @returns @c false if there is no compiled expression.*/
+    bool evaluate_batch(const size_t lanes, te_type* results);
+    /** @brief Evaluates like evaluate_batch(), but in single precision.
+        @details The bound variables are still read as te_type and rounded to
+            float. Arithmetic and the common library functions then run in float,
+            which fits twice as many lanes into a vector register. Other functions
+            are called in te_type and their results rounded.
+        @param lanes The number of value sets.
+        @param[out] results Receives @c lanes results, NaN for lanes that fail.
+        @returns @c false if there is no compiled expression.*/
+    bool evaluate_batch_float(const size_t lanes, float* results);
+    /** @brief Evaluates the expression passed to compile() previously together
+            with its gradient, using forward-mode automatic differentiation.
+        @details Arithmetic operators and the elementary pure built-ins (sqr, sqrt,
+            pow, exp, ln, log10, the trigonometric and hyperbolic functions, abs, etc.)
+            are differentiated; rounding functions and sign have a zero derivative.
+        @param variables The addresses of the bound variables to differentiate with respect to.
+        @param[out] gradient Receives one partial derivative per entry of @c variables.
+        @returns The value of the expression, or NaN if evaluation fails or the
+            expression uses a function without a known derivative.*/
+    te_type evaluate_gradient(const std::vector<const te_type*>& variables,
+                              std::vector<te_type>& gradient);
+    /** @brief Translates the expression passed to compile() previously into C.
+        @details The generated statements read the variables bound with
+            set_indexed_variables() from an array parameter named @c x and end with
+            a @c return statement, so they can serve as the body of
+            `double f(const double* x)`. Operations that throw in the interpreter
+            (e.g., division by zero) produce NaN instead.
+        @param[out] source Receives the C statements.
+        @returns @c false if the expression uses custom variables or functions, or
+            built-ins without a C translation.*/
+    bool generate_c_source(std::string& source) const;
+    /** @brief Evaluates the expression passed to compile() previously and remembers
+            the value of every subexpression as the base for evaluate_changed().
+        @returns The result, or NaN on error.*/
+    te_type evaluate_base();
+    /** @brief Evaluates the expression after a single variable has changed since
+            evaluate_base(), recomputing only the subexpressions that depend on it.
+        @details The remembered base values are kept, so several variants of the
+            base point (e.g., each with a different coordinate shifted) can be
+            evaluated in turn. Impure functions are always recomputed.
+        @param variable The address of the bound variable that changed.
+        @returns The result, or NaN on error.*/
+    te_type evaluate_changed(const te_type* variable);
+    /** @brief Copies the expression passed to compile() previously into an
+            immutable program that several threads can evaluate at once.
+        @details Variables bound with set_indexed_variables() are read from the
+            te_context passed to the program. The program does not refer to the parser,
+            which can be recompiled or destroyed, so expressions that read other
+            variables (through their addresses) or call closures (whose contexts
+            live in the parser) cannot be turned into a program.
+        @returns The program, or null if the expression was not compiled successfully
+            or reads variables other than the indexed ones or calls closures.*/
+    [[nodiscard]]
+    std::shared_ptr<const te_program> get_program() const;
 
     /// @returns The last call to evaluate()'s result (which will be NaN on error).
     [[nodiscard]]
@@ -504,6 +679,38 @@ class te_parser
         m_customFuncsAndVars = std::move(vars);
         }
 
+    /// @brief Binds the variables @c prefix1 .. @c prefixN (e.g., @c x1 .. @c x100)
+    ///     to consecutive elements of an array, without building named variables.
+    /// @details The names are recognized while tokenizing, so compiling does not
+    ///     get slower as the number of variables grows. They take precedence over
+    ///     custom variables with the same names.
+    /// @param values The array; variable @c K is bound to `values[(K - 1) * stride]`.
+    /// @param count The number of variables (N).
+    /// @param stride The distance between the values of two consecutive variables.
+    /// @param prefix The letter that the variable names start with.
+    void set_indexed_variables(const te_type* values, const size_t count, const size_t stride = 1,
+                               const char prefix = 'x') noexcept
+        {
+        m_indexedValues = values;
+        m_indexedCount = count;
+        m_indexedStride = stride;
+        m_indexedPrefix = prefix;
+        }
+
+    /// @brief Names the last @c count variables bound with set_indexed_variables()
+    ///     @c prefix1 .. @c prefixM, e.g., parameters @c p1 .. @c pM stored after
+    ///     @c x1 .. @c xN in the same array.
+    /// @details Parameters are indexed variables in every other respect, so their
+    ///     values can change between evaluations without recompiling and every
+    ///     lane of a batch has its own.
+    /// @param count The number of parameters (M).
+    /// @param prefix The letter that the parameter names start with.
+    void set_indexed_parameters(const size_t count, const char prefix = 'p') noexcept
+        {
+        m_indexedParameterCount = count;
+        m_indexedParameterPrefix = prefix;
+        }
+
     /// @brief Adds a custom variable or function.
     /// @param var The variable/function to add.
     /// @note Prefer using set_variables_and_functions() as it will be more optimal
@@ -733,8 +940,10 @@ class te_parser
         m_lastErrorMessage.clear();
         m_result = te_nan;
         m_parseSuccess = false;
-        te_free(m_compiledExpression);
         m_compiledExpression = nullptr;
+        free_shared();
+        clear_base();
+        m_arena.reset();
         m_currentVar = m_functions.cend();
         m_varFound = false;
 #ifndef TE_NO_BOOKKEEPING
@@ -984,29 +1193,28 @@ class te_parser
         std::set<te_variable>& m_lookup;
         };
 
+    /* Creates a node in the arena, with its parameter array (all null) right behind it. */
     [[nodiscard]]
-    inline static te_expr* new_expr(const te_variable_flags type, te_variant_type value,
-                                    const std::initializer_list<te_expr*>& parameters)
+    te_expr* allocate_expr(const te_variable_flags type, te_variant_type value,
+                           const size_t parameterCount);
+
+    [[nodiscard]]
+    te_expr* new_expr(const te_variable_flags type, te_variant_type value,
+                      const std::initializer_list<te_expr*>& parameters)
         {
-        te_expr* ret = new te_expr{ type, std::move(value) };
-        ret->m_parameters.resize(
-            std::max<size_t>(std::max<size_t>(parameters.size(), get_arity(ret->m_value)) +
-                                 (is_closure(ret->m_value) ? 1 : 0),
-                             0));
-        if (parameters.size())
-            {
-            std::copy(parameters.begin(), parameters.end(), ret->m_parameters.begin());
-            }
+        const size_t parameterCount = std::max<size_t>(parameters.size(), get_arity(value)) +
+                                      (is_closure(value) ? 1 : 0);
+        te_expr* ret = allocate_expr(type, std::move(value), parameterCount);
+        std::copy(parameters.begin(), parameters.end(), ret->m_parameters.begin());
         return ret;
         }
 
     [[nodiscard]]
-    inline static te_expr* new_expr(const te_variable_flags type, te_variant_type value)
+    te_expr* new_expr(const te_variable_flags type, te_variant_type value)
         {
-        te_expr* ret = new te_expr{ type, std::move(value) };
-        ret->m_parameters.resize(static_cast<size_t>(get_arity(ret->m_value)) +
-                                 (is_closure(ret->m_value) ? 1 : 0));
-        return ret;
+        const size_t parameterCount =
+            static_cast<size_t>(get_arity(value)) + (is_closure(value) ? 1 : 0);
+        return allocate_expr(type, std::move(value), parameterCount);
         }
 
     [[nodiscard]]
@@ -1025,27 +1233,132 @@ class te_parser
     /* Evaluates the expression. */
     [[nodiscard]]
     static te_type te_eval(const te_expr* texp);
-
-    /* Frees the expression. */
-    /* This is safe to call on null pointers. */
-    inline static void te_free(te_expr* texp)
+    /* Evaluates the expression for lanes sets of variable values, computing in L. */
+    template<typename L>
+    void te_eval_batch(const te_expr* texp, const size_t lanes, L* results);
+    /* Evaluates the shared subexpressions and then the expression for all lanes. */
+    template<typename L>
+    void evaluate_batch_lanes(const size_t lanes, L* results);
+
+    template<typename L>
+    std::vector<L>& get_shared_lanes() noexcept
         {
-        if (texp == nullptr)
+        if constexpr (std::is_same_v<L, float>)
             {
-            return;
+            return m_sharedLanesFloat;
+            }
+        else
+            {
+            return m_sharedLanes;
+            }
+        }
+    /* Evaluates the expression and writes its gradient (one value per variable). */
+    te_type te_eval_gradient(const te_expr* texp, const std::vector<const te_type*>& variables,
+                             te_type* gradient);
+
+    /** @brief Moves pure subexpressions that occur more than once in the compiled
+            expression into m_sharedExpressions, replacing every occurrence with
+            a variable bound to the subexpression's slot in m_sharedValues.*/
+    void eliminate_common_subexpressions();
+    /* Appends C statements computing texp to source and returns the name of the
+       C variable holding its value, or an empty string if texp cannot be translated. */
+    std::string generate_c_node(const te_expr* texp, std::string& source, size_t& tempCount) const;
+    /* Appends texp and its parameters to m_baseNodes in post-order, evaluating them,
+       and returns its index. dependencies receives the variables texp reads. */
+    size_t te_eval_base(const te_expr* texp, std::vector<const te_type*>& dependencies,
+                        bool& isVolatile);
+    /* Evaluates node index of m_baseNodes from the values of its parameters. */
+    te_type te_eval_base_node(const size_t index, const std::vector<te_type>& values) const;
+    /* Evaluates the shared subexpressions into their slots, inner ones first. */
+    void evaluate_shared();
+    /* Returns the slot of a shared subexpression's value, or npos if var is not one. */
+    [[nodiscard]]
+    int64_t get_shared_index(const te_type* var) const noexcept
+        {
+        for (size_t i = 0; i < m_sharedValues.size(); ++i)
+            {
+            if (var == &m_sharedValues[i])
+                {
+                return static_cast<int64_t>(i);
+                }
             }
-        te_free_parameters(texp);
-        delete texp;
+        return te_parser::npos;
+        }
+
+    void clear_base()
+        {
+        m_baseNodes.clear();
+        m_baseValues.clear();
+        m_sharedBaseNodes.clear();
+        m_dirtyNodes.clear();
+        m_volatileNodes.clear();
+        }
+
+    void free_shared()
+        {
+        m_sharedExpressions.clear();
+        m_sharedValues.clear();
         }
 
-    static void te_free_parameters(te_expr* texp);
     static void optimize(te_expr* texp);
+    /* Rewrites identities (x*1, x+0, ...), constant divisors and small integer
+       powers into cheaper equivalents. Runs after optimize(). */
+    static void simplify(te_expr* texp);
+    /* Replaces the node with its parameter at index, freeing the other parameters. */
+    static void replace_with_parameter(te_expr* texp, const size_t index);
+
+    [[nodiscard]]
+    static std::set<te_variable>::const_iterator find_builtin(const std::string_view name);
 
+    /// @returns The address a name like @c x12 or @c p3 is bound to by
+    ///     set_indexed_variables() and set_indexed_parameters(), or null if it
+    ///     is not such a name.
     [[nodiscard]]
-    static auto find_builtin(const std::string_view name)
+    const te_type* find_indexed_variable(const std::string_view name) const noexcept
         {
-        return m_functions.find(te_variable{ te_variable::name_type{ name },
-                                             static_cast<te_type>(0.0), TE_DEFAULT, nullptr });
+        if (m_indexedValues == nullptr || m_indexedParameterCount > m_indexedCount)
+            {
+            return nullptr;
+            }
+        const size_t variableCount = m_indexedCount - m_indexedParameterCount;
+        size_t index = parse_indexed_name(name, m_indexedPrefix, variableCount);
+        if (index != 0)
+            {
+            return m_indexedValues + (index - 1) * m_indexedStride;
+            }
+        index = parse_indexed_name(name, m_indexedParameterPrefix, m_indexedParameterCount);
+        if (index != 0)
+            {
+            return m_indexedValues + (variableCount + index - 1) * m_indexedStride;
+            }
+        return nullptr;
+        }
+
+    /// @returns @c K if @c name is @c prefix followed by @c K, with 1 <= @c K <= @c count,
+    ///     otherwise 0.
+    [[nodiscard]]
+    static size_t parse_indexed_name(const std::string_view name, const char prefix,
+                                     const size_t count) noexcept
+        {
+        if (name.length() < 2 || te_string_less::tolower(name[0]) != te_string_less::tolower(prefix) ||
+            name[1] == '0')
+            {
+            return 0;
+            }
+        size_t index{ 0 };
+        for (size_t i = 1; i < name.length(); ++i)
+            {
+            if (name[i] < '0' || name[i] > '9')
+                {
+                return 0;
+                }
+            index = index * 10 + static_cast<size_t>(name[i] - '0');
+            if (index > count)
+                {
+                return 0;
+                }
+            }
+        return index;
         }
 
     [[nodiscard]]
@@ -1098,9 +1411,50 @@ class te_parser
     char m_decimalSeparator{ '.' };
     char m_listSeparator{ ',' };
 
+    const te_type* m_indexedValues{ nullptr };
+    size_t m_indexedCount{ 0 };
+    size_t m_indexedStride{ 1 };
+    char m_indexedPrefix{ 'x' };
+    size_t m_indexedParameterCount{ 0 };
+    char m_indexedParameterPrefix{ 'p' };
+
     // state information
     std::string m_expression;
+    // owns every node of m_compiledExpression and m_sharedExpressions
+    te_expr_arena m_arena;
     te_expr* m_compiledExpression{ nullptr };
+    // subexpressions repeated in the compiled expression, computed once per evaluation
+    std::vector<te_expr*> m_sharedExpressions;
+    std::vector<te_type> m_sharedValues;
+    // per-lane values (or gradients) of the shared subexpressions
+    std::vector<te_type> m_sharedLanes;
+    std::vector<float> m_sharedLanesFloat;
+
+    // the nodes recorded by evaluate_base() in post-order (the root is last)
+    struct te_base_node
+        {
+        const te_expr* m_expr{ nullptr };
+        // indices of the parameters in m_baseNodes (npos for missing ones);
+        // for a shared subexpression's slot, the index of its root
+        std::vector<size_t> m_parameters;
+        };
+    std::vector<te_base_node> m_baseNodes;
+    std::vector<te_type> m_baseValues;
+    struct te_shared_base_node
+        {
+        size_t m_index{ 0 };
+        std::vector<const te_type*> m_dependencies;
+        bool m_volatile{ false };
+        };
+    std::vector<te_shared_base_node> m_sharedBaseNodes;
+    // variable -> indices of the nodes that depend on it, ascending
+    std::map<const te_type*, std::vector<size_t>, std::less<>> m_dirtyNodes;
+    // nodes depending on impure functions, recomputed for every change
+    std::vector<size_t> m_volatileNodes;
+    // scratch buffers of evaluate_changed(): the nodes it recomputes and
+    // their base values, restored afterwards
+    std::vector<size_t> m_changedNodes;
+    std::vector<te_type> m_changedValues;
 
     bool m_parseSuccess{ false };
     int64_t m_errorPos{ 0 };
@@ -1117,4 +1471,138 @@ class te_parser
 #endif
     };
 
+/// @brief The state of evaluating a te_program: the variable values, the
+///     intermediate results and the error status.
+/// @details A context is cheap and owned by the caller; every thread evaluating
+///     the same program uses its own.
+class te_context
+    {
+  public:
+    /// @brief Binds the variables of the program's indexed variables to an array.
+    /// @param values The array; variable @c K is read from `values[(K - 1) * stride]`.
+    /// @param stride The distance between the values of two consecutive variables.
+    void set_variables(const te_type* values, const size_t stride = 1) noexcept
+        {
+        m_variables = values;
+        m_stride = stride;
+        }
+
+    /// @returns @c true if the last evaluation succeeded.
+    [[nodiscard]]
+    bool success() const noexcept
+        {
+        return m_success;
+        }
+
+    /// @returns The result of the last evaluation, or NaN if it failed.
+    [[nodiscard]]
+    te_type get_result() const noexcept
+        {
+        return m_result;
+        }
+
+    /// @returns The error message of the last evaluation that failed.
+    [[nodiscard]]
+    const std::string& get_last_error_message() const noexcept
+        {
+        return m_lastErrorMessage;
+        }
+
+  private:
+    friend class te_program;
+
+    const te_type* m_variables{ nullptr };
+    size_t m_stride{ 1 };
+    // the value of every instruction of the program
+    std::vector<te_type> m_values;
+    // the values remembered by te_program::evaluate_base()
+    std::vector<te_type> m_baseValues;
+    // m_values equals m_baseValues, evaluate_changed() only has to patch it
+    bool m_holdsBase{ false };
+    std::vector<size_t> m_changed;
+    te_type m_result{ te_parser::te_nan };
+    bool m_success{ false };
+    std::string m_lastErrorMessage;
+    };
+
+/// @brief A compiled expression that does not change once built.
+/// @details Created by te_parser::get_program(). The expression is stored as a
+///     list of instructions in post order, every one reading the results of
+///     earlier ones, so evaluating it only writes to the te_context.
+class te_program
+    {
+  public:
+    /// @private
+    te_program(const te_program&) = delete;
+    /// @private
+    te_program& operator=(const te_program&) = delete;
+
+    /// @returns The number of indexed variables the program reads.
+    [[nodiscard]]
+    size_t get_variable_count() const noexcept
+        {
+        return m_variableCount;
+        }
+
+    /// @brief Evaluates the program with the variables bound to @c context.
+    /// @returns The result, or NaN on error (see te_context::success()).
+    te_type evaluate(te_context& context) const;
+    /// @brief Evaluates the program and remembers the value of every instruction
+    ///     in @c context as the base for evaluate_changed().
+    /// @returns The result, or NaN on error.
+    te_type evaluate_base(te_context& context) const;
+    /// @brief Evaluates the program after a single indexed variable has changed
+    ///     since evaluate_base(), recomputing only the instructions depending on it.
+    /// @param context The context passed to evaluate_base().
+    /// @param variable The zero-based index of the variable (0 for @c x1).
+    /// @returns The result, or NaN on error.
+    te_type evaluate_changed(te_context& context, const size_t variable) const;
+
+  private:
+    friend class te_parser;
+
+    constexpr static size_t npos = static_cast<size_t>(-1);
+
+    struct instruction
+        {
+        // the constant or the function
+        te_variant_type m_value;
+        // the index of an indexed variable
+        size_t m_variable{ npos };
+        // the instructions computing the arguments, in m_operands
+        size_t m_firstOperand{ 0 };
+        size_t m_operandCount{ 0 };
+        };
+
+    struct shared_instruction
+        {
+        size_t m_index{ 0 };
+        std::vector<size_t> m_dependencies;
+        bool m_volatile{ false };
+        };
+
+    te_program() = default;
+    /* Appends the instructions computing texp and returns the index of the last one.
+       dependencies receives the indexed variables texp reads. */
+    size_t add_instructions(const te_parser& parser, const te_expr* texp,
+                            std::vector<size_t>& dependencies, bool& isVolatile,
+                            const std::vector<shared_instruction>& shared);
+    /* Computes one instruction from the values of the earlier ones. */
+    te_type execute(const size_t index, const te_context& context,
+                    const std::vector<te_type>& values) const;
+    /* Runs the instructions listed in indices, in order, and stores the result. */
+    template<typename Indices>
+    te_type run(te_context& context, const Indices& indices) const;
+
+    std::vector<instruction> m_instructions;
+    std::vector<size_t> m_operands;
+    size_t m_variableCount{ 0 };
+    // for every indexed variable, the instructions depending on it
+    std::vector<std::vector<size_t>> m_dirtyInstructions;
+    // instructions with impure functions, recomputed every time
+    std::vector<size_t> m_volatileInstructions;
+    // set by add_instructions() when an instruction points into the parser
+    bool m_refersToParser{ false };
+    };
+
 #endif // __TINYEXPR_PLUS_PLUS_H__
@@ -1,37 +1,237 @@
 #pragma once
 
 #include <vector>
+#include <type_traits>
 
 using namespace std;
 
-vector<double> operator*(const vector<double>& vec, double scalar) {
-	vector<double> result(vec.size());
-	for (int i = 0; i < vec.size(); i++) {
-		result[i] = vec[i] * scalar;
+// Arithmetic on vector<double> builds lazy expression objects instead of
+// vectors. An expression is evaluated element by element in a single loop
+// when it is converted to vector<double> or added into one with +=, so
+// a * x + b * y allocates only the result.
+
+template<class E>
+struct vectorExpr {
+	const E& self() const {
+		return static_cast<const E&>(*this);
 	}
-	return result;
+	size_t size() const {
+		return self().size();
+	}
+	double operator[](size_t i) const {
+		return self()[i];
+	}
+	operator vector<double>() const {
+		vector<double> result(size());
+		for (size_t i = 0; i < result.size(); i++) {
+			result[i] = self()[i];
+		}
+		return result;
+	}
+};
+
+struct vectorRef : vectorExpr<vectorRef> {
+	const vector<double>& vec;
+	vectorRef(const vector<double>& vec) : vec(vec) {}
+	size_t size() const {
+		return vec.size();
+	}
+	double operator[](size_t i) const {
+		return vec[i];
+	}
+};
+
+template<class T>
+struct isVectorOperand : is_base_of<vectorExpr<T>, T> {};
+
+template<>
+struct isVectorOperand<vector<double>> : true_type {};
+
+// Vectors are held by reference, nested expressions by value.
+template<class T>
+struct vectorOperand {
+	typedef T type;
+};
+
+template<>
+struct vectorOperand<vector<double>> {
+	typedef vectorRef type;
+};
+
+template<class T>
+using vectorOperandType = typename vectorOperand<T>::type;
+
+struct plusOp {
+	static double apply(double a, double b) { return a + b; }
+};
+
+struct minusOp {
+	static double apply(double a, double b) { return a - b; }
+};
+
+struct multipliesOp {
+	static double apply(double a, double b) { return a * b; }
+};
+
+struct dividesOp {
+	static double apply(double a, double b) { return a / b; }
+};
+
+template<class L, class R, class Op>
+struct binaryVectorExpr : vectorExpr<binaryVectorExpr<L, R, Op>> {
+	L left;
+	R right;
+	binaryVectorExpr(const L& left, const R& right) : left(left), right(right) {}
+	size_t size() const {
+		return left.size();
+	}
+	double operator[](size_t i) const {
+		return Op::apply(left[i], right[i]);
+	}
+};
+
+template<class E, class Op>
+struct scalarVectorExpr : vectorExpr<scalarVectorExpr<E, Op>> {
+	E vec;
+	double scalar;
+	scalarVectorExpr(const E& vec, double scalar) : vec(vec), scalar(scalar) {}
+	size_t size() const {
+		return vec.size();
+	}
+	double operator[](size_t i) const {
+		return Op::apply(vec[i], scalar);
+	}
+};
+
+template<class L, class R>
+using enableIfVectors = enable_if_t<isVectorOperand<L>::value && isVectorOperand<R>::value, int>;
+
+template<class V>
+using enableIfVector = enable_if_t<isVectorOperand<V>::value, int>;
+
+template<class V, enableIfVector<V> = 0>
+scalarVectorExpr<vectorOperandType<V>, multipliesOp> operator*(const V& vec, double scalar) {
+	return { vec, scalar };
+}
+
+template<class V, enableIfVector<V> = 0>
+scalarVectorExpr<vectorOperandType<V>, dividesOp> operator/(const V& vec, double scalar) {
+	return { vec, scalar };
+}
+
+template<class L, class R, enableIfVectors<L, R> = 0>
+binaryVectorExpr<vectorOperandType<L>, vectorOperandType<R>, plusOp> operator+(const L& vec1, const R& vec2) {
+	return { vec1, vec2 };
+}
+
+template<class L, class R, enableIfVectors<L, R> = 0>
+binaryVectorExpr<vectorOperandType<L>, vectorOperandType<R>, minusOp> operator-(const L& vec1, const R& vec2) {
+	return { vec1, vec2 };
 }
 
-vector<double> operator/(const vector<double>& vec, double scalar) {
-	vector<double> result(vec.size());
-	for (int i = 0; i < vec.size(); i++) {
-		result[i] = vec[i] / scalar;
+template<class E>
+vector<double>& operator+=(vector<double>& vec, const vectorExpr<E>& expr) {
+	for (size_t i = 0; i < vec.size(); i++) {
+		vec[i] += expr[i];
 	}
-	return result;
+	return vec;
 }
 
-vector<double> operator+(const vector<double>& vec1, const vector<double>& vec2) {
-	vector<double> result(vec1.size());
-	for (int i = 0; i < vec1.size(); i++) {
-		result[i] = vec1[i] + vec2[i];
+// Fused trial point kernels: dst = c + t * (p - c) in one pass, without
+// temporaries. The widest instruction set supported by the CPU is picked once
+// at startup; the scalar loop is the fallback and handles the tails.
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define VECTOR_OPS_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define VECTOR_OPS_TARGET(isa)
+#else
+#include <cpuid.h>
+#define VECTOR_OPS_TARGET(isa) __attribute__((target(isa)))
+#endif
+#endif
+
+typedef void (*affineCombinationKernel)(double* dst, const double* c, const double* p, double t, size_t size);
+
+inline void affineCombinationScalar(double* dst, const double* c, const double* p, double t, size_t size) {
+	for (size_t i = 0; i < size; i++) {
+		dst[i] = c[i] + t * (p[i] - c[i]);
 	}
-	return result;
 }
 
-vector<double> operator-(const vector<double>& vec1, const vector<double>& vec2) {
-	vector<double> result(vec1.size());
-	for (int i = 0; i < vec1.size(); i++) {
-		result[i] = vec1[i] - vec2[i];
+#ifdef VECTOR_OPS_X86
+VECTOR_OPS_TARGET("avx2")
+inline void affineCombinationAvx2(double* dst, const double* c, const double* p, double t, size_t size) {
+	const __m256d tt = _mm256_set1_pd(t);
+	size_t i = 0;
+	for (; i + 4 <= size; i += 4) {
+		__m256d cc = _mm256_loadu_pd(c + i);
+		__m256d diff = _mm256_sub_pd(_mm256_loadu_pd(p + i), cc);
+		_mm256_storeu_pd(dst + i, _mm256_add_pd(cc, _mm256_mul_pd(tt, diff)));
 	}
+	affineCombinationScalar(dst + i, c + i, p + i, t, size - i);
+}
+
+VECTOR_OPS_TARGET("avx512f")
+inline void affineCombinationAvx512(double* dst, const double* c, const double* p, double t, size_t size) {
+	const __m512d tt = _mm512_set1_pd(t);
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8) {
+		__m512d cc = _mm512_loadu_pd(c + i);
+		__m512d diff = _mm512_sub_pd(_mm512_loadu_pd(p + i), cc);
+		_mm512_storeu_pd(dst + i, _mm512_add_pd(cc, _mm512_mul_pd(tt, diff)));
+	}
+	if (i < size) {
+		__mmask8 tail = (__mmask8)((1u << (size - i)) - 1);
+		__m512d cc = _mm512_maskz_loadu_pd(tail, c + i);
+		__m512d diff = _mm512_sub_pd(_mm512_maskz_loadu_pd(tail, p + i), cc);
+		_mm512_mask_storeu_pd(dst + i, tail, _mm512_add_pd(cc, _mm512_mul_pd(tt, diff)));
+	}
+}
+
+// AVX state must be enabled by the OS (XCR0), not only reported by CPUID.
+inline void detectVectorExtensions(bool& avx2, bool& avx512) {
+	avx2 = avx512 = false;
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 1);
+	if (!(info[2] & (1 << 27)) || !(info[2] & (1 << 28))) return;
+	unsigned long long xcr0 = _xgetbv(0);
+	__cpuidex(info, 7, 0);
+	unsigned int features = info[1];
+#else
+	unsigned int eax, ebx, ecx, edx;
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return;
+	if (!(ecx & (1u << 27)) || !(ecx & (1u << 28))) return;
+	unsigned int xcrLow, xcrHigh;
+	__asm__("xgetbv" : "=a"(xcrLow), "=d"(xcrHigh) : "c"(0));
+	unsigned long long xcr0 = ((unsigned long long)xcrHigh << 32) | xcrLow;
+	if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) return;
+	unsigned int features = ebx;
+#endif
+	bool avxState = (xcr0 & 0x6) == 0x6;
+	bool avx512State = (xcr0 & 0xE6) == 0xE6;
+	avx2 = avxState && (features & (1u << 5));
+	avx512 = avx512State && (features & (1u << 16));
+}
+#endif
+
+inline affineCombinationKernel chooseAffineCombinationKernel() {
+#ifdef VECTOR_OPS_X86
+	bool avx2, avx512;
+	detectVectorExtensions(avx2, avx512);
+	if (avx512) return affineCombinationAvx512;
+	if (avx2) return affineCombinationAvx2;
+#endif
+	return affineCombinationScalar;
+}
+
+inline const affineCombinationKernel affineCombinationInto = chooseAffineCombinationKernel();
+
+inline vector<double> affineCombination(const vector<double>& c, const vector<double>& p, double t) {
+	vector<double> result(c.size());
+	affineCombinationInto(result.data(), c.data(), p.data(), t, c.size());
 	return result;
-}
\ No newline at end of file
+}
@@ -67,4 +67,10 @@ public:
 			file.close();
 		}
 	}
-};
\ No newline at end of file
+};
+
+class nullWriter : public writer {
+public:
+	void write(string) override {}
+	void closeFile() override {}
+};